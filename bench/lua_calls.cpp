@@ -0,0 +1,75 @@
+/// Lua binding overhead: per call cost of renderer functions called from
+/// Lua, next to an empty loop and a plain Lua closure call. Each case is
+/// timed over CALLS calls and the best of ROUNDS runs is reported.
+///
+/// From the repository root:
+///   g++ -O2 -std=gnu++17 -fno-strict-aliasing -DLUA_USE_POSIX -Isrc -o lua_calls
+///     bench/lua_calls.cpp src/LuaRenderer.cpp src/Renderer.cpp src/Arena.cpp
+///     src/Scheduler.cpp src/lib/stb/stb_truetype.c -x c++ src/lib/lua52/*.c -lSDL2 -lm
+///   SDL_VIDEODRIVER=dummy ./lua_calls
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "include/Renderer.hpp"
+#include "include/LuaRenderer.hpp"
+#include "lib/lua52/lualib.h"
+#include "lib/lua52/lauxlib.h"
+
+#define WIDTH 800
+#define HEIGHT 600
+
+static const char *script =
+  "local CALLS, ROUNDS = 5000000, 5\n"
+  "local draw_rect = renderer.draw_rect\n"
+  "local function time(name, f)\n"
+  "  local best = math.huge\n"
+  "  for _ = 1, ROUNDS do\n"
+  "    local t = os.clock()\n"
+  "    f(CALLS)\n"
+  "    t = os.clock() - t\n"
+  "    if t < best then best = t end\n"
+  "  end\n"
+  "  print(string.format('%-24s %6.1f ns', name, best / CALLS * 1e9))\n"
+  "end\n"
+  "local function nop() end\n"
+  "time('empty loop', function(n) for i = 1, n do end end)\n"
+  "time('Lua closure call', function(n) for i = 1, n do nop(i, i, 4, 4) end end)\n"
+  "time('draw_rect, clipped out', function(n)\n"
+  "  for i = 1, n do draw_rect(-10, -10, 4, 4, 0xff0000ff) end\n"
+  "end)\n"
+  "time('draw_rect, 4x4 fill', function(n)\n"
+  "  for i = 1, n do draw_rect(i % 700, 100, 4, 4, 0xff0000ff) end\n"
+  "end)\n"
+  "time('draw_rect, 4x4 blend', function(n)\n"
+  "  for i = 1, n do draw_rect(i % 700, 100, 4, 4, 0xff000080) end\n"
+  "end)\n";
+
+int main (void)
+{
+  if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+    fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
+    return EXIT_FAILURE;
+  }
+  SDL_Window *window = SDL_CreateWindow("bench", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+    WIDTH, HEIGHT, SDL_WINDOW_HIDDEN);
+  if (!window) {
+    fprintf(stderr, "SDL_CreateWindow: %s\n", SDL_GetError());
+    return EXIT_FAILURE;
+  }
+  RInit(window, 1);
+
+  lua_State *L = luaL_newstate();
+  luaL_openlibs(L);
+  luaL_requiref(L, "renderer", luaopen_renderer, 1);
+  lua_pop(L, 1);
+  int status = EXIT_SUCCESS;
+  if (luaL_dostring(L, script) != LUA_OK) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    status = EXIT_FAILURE;
+  }
+  lua_close(L);
+  SDL_DestroyWindow(window);
+  SDL_Quit();
+  return status;
+}
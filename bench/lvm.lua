@@ -0,0 +1,82 @@
+-- Interpreter workloads shaped like the editor's own Lua: tokenizer
+-- records, line building, highlighter callbacks and column layout.
+-- Each one prints the best of ROUNDS runs and a checksum, so both
+-- dispatch builds can be compared by bench/lvm.sh
+
+local ROUNDS = 5
+
+local function time(name, f)
+  local best = math.huge
+  local r
+  for _ = 1, ROUNDS do
+    local t = os.clock()
+    r = f()
+    t = os.clock() - t
+    if t < best then best = t end
+  end
+  print(string.format("%-10s %7.1f ms  %s", name, best * 1000, tostring(r)))
+end
+
+-- table heavy: tokenizer-like records, array and hash access
+time("tables", function()
+  local sum = 0
+  for _ = 1, 20 do
+    local toks = {}
+    for i = 1, 20000 do
+      toks[i] = { type = (i % 3 == 0) and "keyword" or "symbol", pos = i, len = i % 7 }
+    end
+    for i = 1, #toks do
+      local t = toks[i]
+      if t.type == "keyword" then sum = sum + t.len * t.pos % 13 end
+    end
+  end
+  return sum
+end)
+
+-- string building: concat, table.concat and gsub
+time("strings", function()
+  local n = 0
+  for _ = 1, 30 do
+    local parts = {}
+    for i = 1, 5000 do parts[#parts + 1] = "x" .. i .. ":" .. (i * 2) end
+    local s = table.concat(parts, " ")
+    n = n + #s + select(2, s:gsub("%d+", ""))
+  end
+  return n
+end)
+
+-- closure calls: highlighter style callbacks and small helpers
+time("closures", function()
+  local function make(k) return function(x) return x * k + 1 end end
+  local fs = {}
+  for i = 1, 16 do fs[i] = make(i) end
+  local acc = 0
+  for i = 1, 3000000 do acc = (acc + fs[i % 16 + 1](i)) % 1000003 end
+  return acc
+end)
+
+-- layout: per line column measurement through method calls
+time("layout", function()
+  local Doc = {}
+  Doc.__index = Doc
+  function Doc:width(line)
+    local w = 0
+    for c = 1, #line do w = w + (line:byte(c) == 9 and 4 or 1) end
+    return w
+  end
+  local d = setmetatable({ lines = {} }, Doc)
+  for i = 1, 2000 do d.lines[i] = string.rep("ab\tcd ", i % 20 + 1) end
+  local total = 0
+  for _ = 1, 20 do
+    for i = 1, #d.lines do total = total + d:width(d.lines[i]) end
+  end
+  return total
+end)
+
+-- count hooks and runtime errors must behave the same with either dispatch
+local count = 0
+debug.sethook(function() count = count + 1 end, "", 1000)
+for i = 1, 100000 do local _ = i * 2 end
+debug.sethook()
+local ok, err = pcall(function() local t = nil; return t.x end)
+print("hook", count > 50, "error", ok, err)
@@ -0,0 +1,26 @@
+#!/bin/bash
+# Builds the standalone interpreter twice, with the computed goto dispatch
+# of luaV_execute and with the portable switch (-DLUA_NO_JUMPTABLE), then
+# runs bench/lvm.lua on both in turns. Run from the repository root:
+#   bench/lvm.sh [rounds]
+
+rounds=${1:-3}
+cflags="-O3 -std=gnu++17 -fno-strict-aliasing -DLUA_USE_POSIX -Isrc/lib/lua52"
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+sources=""
+for f in `find src/lib/lua52 -name "*.c"`; do
+  sources="$sources $f"
+done
+
+echo "building..."
+g++ $cflags -o "$tmp/jump" -x c++ src/lib/lua52/lua.c_ $sources -lm || exit 1
+g++ $cflags -DLUA_NO_JUMPTABLE -o "$tmp/switch" -x c++ src/lib/lua52/lua.c_ $sources -lm || exit 1
+
+for ((i = 1; i <= rounds; i++)); do
+  echo "-- round $i, computed goto"
+  "$tmp/jump" bench/lvm.lua || exit 1
+  echo "-- round $i, switch"
+  "$tmp/switch" bench/lvm.lua || exit 1
+done
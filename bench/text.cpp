@@ -0,0 +1,102 @@
+/// Text blending benchmark: draws a screen of text with every blending
+/// mode, the line cache off so each frame goes through the glyph kernels.
+/// Modes are interleaved and the best round of each is reported.
+///
+/// From the repository root:
+///   g++ -O3 -std=gnu++17 -fno-strict-aliasing -Isrc -o text bench/text.cpp
+///     src/Renderer.cpp src/Arena.cpp src/lib/stb/stb_truetype.c -lSDL2 -lm
+///   SDL_VIDEODRIVER=dummy ./text font.ttf [size]
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "include/Renderer.hpp"
+
+#define WIDTH 800
+#define HEIGHT 600
+#define FRAMES 200
+#define ROUNDS 10
+
+typedef struct {
+  const char *name;
+  RAntialiasing antialiasing;
+  bool linear;
+  double best;
+} Mode;
+
+static const char *line =
+  "static inline RColor blendPixelLinear (RColor dst, RColor src, const uint16_t *lcolor, int ca)";
+
+static double now (void)
+{
+  return (double) SDL_GetPerformanceCounter() / SDL_GetPerformanceFrequency();
+}
+
+/// seconds per frame
+static double drawFrames (RFont *font, int lineHeight)
+{
+  RColor background = { 0x2e, 0x2e, 0x32, 0xff };
+  RColor text = { 0xe1, 0xe1, 0xe6, 0xff };
+  double start = now();
+  for (int i = 0; i < FRAMES; i++) {
+    RDrawRect((RRect) { 0, 0, WIDTH, HEIGHT }, background);
+    for (int y = 0; y + lineHeight <= HEIGHT; y += lineHeight) {
+      RDrawText(font, line, 0, y, text);
+    }
+  }
+  return (now() - start) / FRAMES;
+}
+
+int main (int argc, char **argv)
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s font.ttf [size]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+    fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
+    return EXIT_FAILURE;
+  }
+  SDL_Window *window = SDL_CreateWindow("bench", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+    WIDTH, HEIGHT, SDL_WINDOW_HIDDEN);
+  if (!window) {
+    fprintf(stderr, "SDL_CreateWindow: %s\n", SDL_GetError());
+    return EXIT_FAILURE;
+  }
+  RInit(window, 1);
+  RSetLineCacheBudget(0);
+
+  RFont *font = RLoadFont(argv[1], argc > 2 ? atof(argv[2]) : 16);
+  if (!font) {
+    fprintf(stderr, "can't load %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  int lineHeight = RGetFontHeigh(font);
+
+  Mode modes[] = {
+    { "grayscale srgb",   R_AA_GRAYSCALE, false, 1e9 },
+    { "grayscale linear", R_AA_GRAYSCALE, true,  1e9 },
+    { "subpixel srgb",    R_AA_SUBPIXEL,  false, 1e9 },
+    { "subpixel linear",  R_AA_SUBPIXEL,  true,  1e9 },
+  };
+  int count = sizeof(modes) / sizeof(modes[0]);
+
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int m = 0; m < count; m++) {
+      RSetFontAntialiasing(font, modes[m].antialiasing);
+      RSetTextBlending(modes[m].linear, 0.2f, 0.1f);
+      /* bakes the glyphs outside the timed frames */
+      RDrawText(font, line, 0, 0, (RColor) { 0, 0, 0, 0xff });
+      double t = drawFrames(font, lineHeight);
+      if (t < modes[m].best) { modes[m].best = t; }
+    }
+  }
+
+  for (int m = 0; m < count; m++) {
+    printf("%-18s %7.3f ms/frame\n", modes[m].name, modes[m].best * 1000);
+  }
+  RFreeFont(font);
+  SDL_DestroyWindow(window);
+  SDL_Quit();
+  return EXIT_SUCCESS;
+}
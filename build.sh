@@ -55,6 +55,10 @@ done
 if [[ ! $got_error ]]; then
   echo "linking..."
   $compiler *.o $lflags
+  if [[ $? -eq 0 && -d modules ]]; then
+    echo "packing modules..."
+    ./$out --pack modules.pack modules
+  fi
 fi
 
 echo "cleaning up..."
@@ -65,5 +69,6 @@ rm res.res 2>/dev/null
 if [ "$1" = "clean" ]; then
   # cleaning after moon
   find modules -type f -name '*.lua' -delete
+  rm -f modules.pack
   echo "done" 
 fi
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include "include/Arena.hpp"
+
+/// Blocks up to SLAB_LIMIT are carved from SLAB_SIZE slabs, bigger ones
+/// are allocated one by one. Either way a freed block goes on the free list
+/// of its class and is handed out again before anything new is reserved.
+/// Lists match exact classes: an atlas that doubles needs a class four
+/// times bigger, the smaller attempt it freed only serves a later set
+/// of the same size.
+#define SLAB_SIZE (256 * 1024)
+#define SLAB_LIMIT (16 * 1024)
+/// freed big blocks past this many bytes go back to the system right away
+#define BIG_CACHE_MAX (32 * 1024 * 1024)
+
+/// classes are 64, 128, 192, 256 then four per power of two
+#define SMALL_CLASSES 4
+#define SMALL_MAX 256
+#define FIRST_SHIFT 8
+
+typedef struct FreeBlock { struct FreeBlock *next; } FreeBlock;
+
+static FreeBlock *freeLists[ARENA_CLASSES];
+static struct { char *cur, *end; } slab;
+static size_t bigCached;
+static ArenaStats stats;
+
+static void* checkAlloc (void *ptr)
+{
+  if (!ptr) {
+    fprintf(stderr, "Fatal error: Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+/// class index of size or -1 if it is too big for any class
+static int sizeClass (size_t size)
+{
+  if (size <= SMALL_MAX) {
+    return size == 0 ? 0 : (size + ARENA_ALIGN - 1) / ARENA_ALIGN - 1;
+  }
+  int k = 63 - __builtin_clzll(size - 1);
+  size_t base = (size_t) 1 << k;
+  size_t quarter = base >> 2;
+  int sub = (size - base + quarter - 1) / quarter;
+  int c = SMALL_CLASSES + (k - FIRST_SHIFT) * 4 + sub - 1;
+  return c < ARENA_CLASSES ? c : -1;
+}
+
+size_t ArenaClassSize (int c)
+{
+  assert(c >= 0 && c < ARENA_CLASSES);
+  if (c < SMALL_CLASSES) {
+    return (size_t) (c + 1) * ARENA_ALIGN;
+  }
+  c -= SMALL_CLASSES;
+  size_t base = (size_t) 1 << (FIRST_SHIFT + c / 4);
+  return base + (c % 4 + 1) * (base >> 2);
+}
+
+static size_t roundUp (size_t size)
+{
+  return (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+}
+
+void* ArenaAlloc (size_t size)
+{
+  int c = sizeClass(size);
+  stats.allocs++;
+
+  if (c < 0) {
+    size = roundUp(size);
+    stats.bytesReserved += size;
+    stats.bytesInUse += size;
+    return checkAlloc(aligned_alloc(ARENA_ALIGN, size));
+  }
+
+  size_t csize = ArenaClassSize(c);
+  FreeBlock *block = freeLists[c];
+
+  if (block) {
+    freeLists[c] = block->next;
+    stats.blocksCached[c]--;
+    stats.bytesCached -= csize;
+    stats.reuses++;
+    if (csize > SLAB_LIMIT) { bigCached -= csize; }
+  } else if (csize <= SLAB_LIMIT) {
+    if (slab.end - slab.cur < (ptrdiff_t) csize) {
+      slab.cur = (char*) checkAlloc(aligned_alloc(ARENA_ALIGN, SLAB_SIZE));
+      slab.end = slab.cur + SLAB_SIZE;
+      stats.bytesReserved += SLAB_SIZE;
+    }
+    block = (FreeBlock*) slab.cur;
+    slab.cur += csize;
+  } else {
+    block = (FreeBlock*) checkAlloc(aligned_alloc(ARENA_ALIGN, csize));
+    stats.bytesReserved += csize;
+  }
+
+  stats.blocksInUse[c]++;
+  stats.bytesInUse += csize;
+  return block;
+}
+
+/// size must be the one given to ArenaAlloc
+void ArenaFree (void *ptr, size_t size)
+{
+  if (!ptr) { return; }
+  int c = sizeClass(size);
+  stats.frees++;
+
+  if (c < 0) {
+    size = roundUp(size);
+    stats.bytesReserved -= size;
+    stats.bytesInUse -= size;
+    free(ptr);
+    return;
+  }
+
+  size_t csize = ArenaClassSize(c);
+  stats.blocksInUse[c]--;
+  stats.bytesInUse -= csize;
+  if (csize > SLAB_LIMIT) {
+    if (bigCached + csize > BIG_CACHE_MAX) {
+      stats.bytesReserved -= csize;
+      free(ptr);
+      return;
+    }
+    bigCached += csize;
+  }
+
+  FreeBlock *block = (FreeBlock*) ptr;
+  block->next = freeLists[c];
+  freeLists[c] = block;
+  stats.blocksCached[c]++;
+  stats.bytesCached += csize;
+}
+
+size_t ArenaTrim (void)
+{
+  size_t released = 0;
+  for (int c = 0; c < ARENA_CLASSES; c++) {
+    size_t csize = ArenaClassSize(c);
+    if (csize <= SLAB_LIMIT) { continue; }
+    while (freeLists[c]) {
+      FreeBlock *block = freeLists[c];
+      freeLists[c] = block->next;
+      free(block);
+      stats.blocksCached[c]--;
+      released += csize;
+    }
+  }
+  bigCached = 0;
+  stats.bytesCached -= released;
+  stats.bytesReserved -= released;
+  return released;
+}
+
+void ArenaGetStats (ArenaStats *out)
+{
+  *out = stats;
+}
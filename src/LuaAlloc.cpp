@@ -0,0 +1,352 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "lib/lua52/lauxlib.h"
+#include "include/LuaAlloc.hpp"
+
+/// Slabs are malloc'ed per thread rather than taken from Arena, which is
+/// not thread safe. They are never given back: a block freed on another
+/// thread than the one that allocated it simply joins that thread's lists.
+#define SLAB_SIZE (64 * 1024)
+/// short_src hash -> tag, direct mapped
+#define TAG_CACHE_SIZE 64
+
+typedef struct FreeBlock { struct FreeBlock *next; } FreeBlock;
+
+typedef struct {
+  FreeBlock *freeLists[LUA_POOL_CLASSES];
+  char *cur, *end;
+  LuaAllocStats stats;
+} Pool;
+
+static thread_local Pool pool;
+
+/// sits in front of tracked blocks, as big as Lua's alignment
+typedef union {
+  uint32_t tag;
+  double align;
+} TagHeader;
+
+typedef struct {
+  uint64_t hash;
+  uint32_t tag;
+} TagCacheEntry;
+
+/// shared by all threads, like the Lua state they describe.
+/// Tags are keyed on short_src, load(str) chunks would otherwise
+/// each keep a copy of their whole text
+static LuaAllocTag tags[LUA_TAGS_MAX] = { { "?", 0, 0, 0 } };
+static int tagCount = 1;
+static uint32_t currentTag;
+static TagCacheEntry tagCache[TAG_CACHE_SIZE];
+static bool tracking;
+
+static inline int sizeClass (size_t size)
+{
+  return (size - 1) / LUA_POOL_STEP;
+}
+
+static void* poolAlloc (size_t size)
+{
+  int c = sizeClass(size);
+  LuaPoolClass *stats = &pool.stats.classes[c];
+  FreeBlock *block = pool.freeLists[c];
+
+  if (block) {
+    pool.freeLists[c] = block->next;
+    stats->cached--;
+  } else {
+    size_t csize = (c + 1) * LUA_POOL_STEP;
+    if (pool.end - pool.cur < (ptrdiff_t) csize) {
+      /* the tail of the old slab is lost, at most LUA_POOL_MAX bytes */
+      char *slab = (char*) malloc(SLAB_SIZE);
+      if (!slab) { return NULL; }
+      pool.cur = slab;
+      pool.end = slab + SLAB_SIZE;
+      pool.stats.slabBytes += SLAB_SIZE;
+    }
+    block = (FreeBlock*) pool.cur;
+    pool.cur += csize;
+  }
+
+  stats->blocks++;
+  stats->bytes += size;
+  stats->allocs++;
+  return block;
+}
+
+static void poolFree (void *ptr, size_t size)
+{
+  int c = sizeClass(size);
+  LuaPoolClass *stats = &pool.stats.classes[c];
+  FreeBlock *block = (FreeBlock*) ptr;
+  block->next = pool.freeLists[c];
+  pool.freeLists[c] = block;
+  stats->blocks--;
+  stats->bytes -= size;
+  stats->cached++;
+}
+
+static void largeFree (void *ptr, size_t size)
+{
+  free(ptr);
+  pool.stats.large.blocks--;
+  pool.stats.large.bytes -= size;
+}
+
+/// Lua assumes shrinking never fails. A shrink into a smaller class that
+/// can't get a block keeps its own, which joins the smaller class being
+/// bigger than that needs. A large block is cut down to the class size
+/// first when realloc manages to
+static void* adoptBlock (void *ptr, size_t osize, size_t nsize)
+{
+  int c = sizeClass(nsize);
+  if (osize > LUA_POOL_MAX) {
+    void *block = realloc(ptr, (c + 1) * LUA_POOL_STEP);
+    if (block) { ptr = block; }
+    pool.stats.large.blocks--;
+    pool.stats.large.bytes -= osize;
+  } else {
+    LuaPoolClass *old = &pool.stats.classes[sizeClass(osize)];
+    old->blocks--;
+    old->bytes -= osize;
+  }
+  LuaPoolClass *stats = &pool.stats.classes[c];
+  stats->blocks++;
+  stats->bytes += nsize;
+  stats->allocs++;
+  return ptr;
+}
+
+/// Lua passes the block's size as osize except when ptr is NULL,
+/// osize is then the type of the object being created
+void* LuaAlloc (void *ud, void *ptr, size_t osize, size_t nsize)
+{
+  (void) ud;
+  if (!ptr) { osize = 0; }
+
+  if (nsize == 0) {
+    if (ptr) {
+      if (osize <= LUA_POOL_MAX) { poolFree(ptr, osize); }
+      else { largeFree(ptr, osize); }
+    }
+    return NULL;
+  }
+
+  if (nsize <= LUA_POOL_MAX) {
+    if (ptr && osize <= LUA_POOL_MAX && sizeClass(osize) == sizeClass(nsize)) {
+      LuaPoolClass *stats = &pool.stats.classes[sizeClass(nsize)];
+      stats->bytes += nsize - osize;
+      return ptr;
+    }
+    void *block = poolAlloc(nsize);
+    if (!block) { return ptr && nsize < osize ? adoptBlock(ptr, osize, nsize) : NULL; }
+    if (ptr) {
+      memcpy(block, ptr, osize < nsize ? osize : nsize);
+      if (osize <= LUA_POOL_MAX) { poolFree(ptr, osize); }
+      else { largeFree(ptr, osize); }
+    }
+    return block;
+  }
+
+  /* large blocks, pooled ones moving up are copied out of the pool */
+  if (ptr && osize > LUA_POOL_MAX) {
+    void *block = realloc(ptr, nsize);
+    if (!block) { return NULL; }
+    pool.stats.large.bytes += nsize - osize;
+    return block;
+  }
+  void *block = malloc(nsize);
+  if (!block) { return NULL; }
+  pool.stats.large.blocks++;
+  pool.stats.large.bytes += nsize;
+  pool.stats.large.allocs++;
+  if (ptr) {
+    memcpy(block, ptr, osize);
+    poolFree(ptr, osize);
+  }
+  return block;
+}
+
+/// Tracking
+
+void* LuaAllocTracked (void *ud, void *ptr, size_t osize, size_t nsize)
+{
+  TagHeader *h = ptr ? (TagHeader*) ptr - 1 : NULL;
+  size_t hsize = sizeof(TagHeader);
+
+  if (nsize == 0) {
+    if (h) {
+      LuaAllocTag *tag = &tags[h->tag];
+      tag->bytes -= osize;
+      tag->blocks--;
+      LuaAlloc(ud, h, osize + hsize, 0);
+    }
+    return NULL;
+  }
+
+  /* with no block osize is Lua's type tag, passed on as is */
+  TagHeader *block = (TagHeader*) LuaAlloc(ud, h, h ? osize + hsize : osize, nsize + hsize);
+  if (!block) { return NULL; }
+  /* a block resized later stays with the chunk that created it */
+  if (h) {
+    tags[block->tag].bytes += nsize - osize;
+  } else {
+    block->tag = currentTag;
+    LuaAllocTag *tag = &tags[currentTag];
+    tag->bytes += nsize;
+    tag->blocks++;
+    tag->allocs++;
+  }
+  return block + 1;
+}
+
+static uint64_t hashString (const char *p)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (; *p; p++) {
+    h = (h ^ (uint8_t) *p) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static uint32_t findTag (const char *shortSrc)
+{
+  uint64_t hash = hashString(shortSrc);
+  TagCacheEntry *cached = &tagCache[hash % TAG_CACHE_SIZE];
+  /* tag 0 is only cached once the table is full, it never changes then */
+  if (cached->hash == hash &&
+      (cached->tag == 0 || !strcmp(tags[cached->tag].source, shortSrc))) {
+    return cached->tag;
+  }
+  uint32_t t = 0;
+  for (int i = 1; i < tagCount; i++) {
+    if (!strcmp(tags[i].source, shortSrc)) {
+      t = i;
+      break;
+    }
+  }
+  if (t == 0 && tagCount < LUA_TAGS_MAX) {
+    snprintf(tags[tagCount].source, sizeof(tags[tagCount].source), "%s", shortSrc);
+    t = tagCount++;
+  }
+  cached->hash = hash;
+  cached->tag = t;
+  return t;
+}
+
+/// count hooks only fire in Lua functions, level 0 is always one
+static void tagHook (lua_State *L, lua_Debug *ar)
+{
+  (void) ar;
+  lua_Debug d;
+  if (!lua_getstack(L, 0, &d)) { return; }
+  lua_getinfo(L, "S", &d);
+  currentTag = findTag(d.short_src);
+}
+
+static int compareTags (const void *a, const void *b)
+{
+  size_t x = ((const LuaAllocTag*) a)->bytes;
+  size_t y = ((const LuaAllocTag*) b)->bytes;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+int LuaAllocGetTags (LuaAllocTag *out, int max)
+{
+  LuaAllocTag all[LUA_TAGS_MAX];
+  int n = tagCount;
+  memcpy(all, tags, n * sizeof(LuaAllocTag));
+  qsort(all, n, sizeof(LuaAllocTag), compareTags);
+  max = max < 0 ? 0 : max > LUA_TAGS_MAX ? LUA_TAGS_MAX : max;
+  n = n < max ? n : max;
+  memcpy(out, all, n * sizeof(LuaAllocTag));
+  return n;
+}
+
+void LuaAllocDumpTags (FILE *fp, int max)
+{
+  LuaAllocTag top[LUA_TAGS_MAX];
+  int n = LuaAllocGetTags(top, max);
+  fprintf(fp, "%12s %10s %12s  %s\n", "live bytes", "blocks", "allocs", "source");
+  for (int i = 0; i < n; i++) {
+    fprintf(fp, "%12zu %10zu %12zu  %s\n",
+      top[i].bytes, top[i].blocks, top[i].allocs, top[i].source);
+  }
+}
+
+static int panic (lua_State *L)
+{
+  fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n",
+    lua_tostring(L, -1));
+  return 0;
+}
+
+/// a tracked state can't go back, its blocks all carry a header
+lua_State* LuaNewState (bool track)
+{
+  lua_State *L = lua_newstate(track ? LuaAllocTracked : LuaAlloc, NULL);
+  if (!L) { return NULL; }
+  lua_atpanic(L, &panic);
+  if (track) {
+    /* coroutines inherit the hook when they are created */
+    lua_sethook(L, tagHook, LUA_MASKCOUNT, LUA_TAG_SAMPLE_COUNT);
+    tracking = true;
+  }
+  return L;
+}
+
+void LuaAllocGetStats (LuaAllocStats *stats)
+{
+  *stats = pool.stats;
+}
+
+/// Lua module
+
+static int isTracking (lua_State *L)
+{
+  lua_pushboolean(L, tracking);
+  return 1;
+}
+
+static int report (lua_State *L)
+{
+  int max = luaL_optint(L, 1, LUA_TAGS_MAX);
+  LuaAllocTag top[LUA_TAGS_MAX];
+  /* copied first, building the result allocates */
+  int n = LuaAllocGetTags(top, max);
+  lua_createtable(L, n, 0);
+  for (int i = 0; i < n; i++) {
+    lua_createtable(L, 0, 4);
+    lua_pushstring(L, top[i].source);
+    lua_setfield(L, -2, "source");
+    lua_pushnumber(L, top[i].bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushnumber(L, top[i].blocks);
+    lua_setfield(L, -2, "blocks");
+    lua_pushnumber(L, top[i].allocs);
+    lua_setfield(L, -2, "allocs");
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+static int dump (lua_State *L)
+{
+  LuaAllocDumpTags(stderr, luaL_optint(L, 1, 20));
+  return 0;
+}
+
+static const luaL_Reg lib[] = {
+  { "tracking",  isTracking },
+  { "report",    report     },
+  { "dump",      dump       },
+  { NULL, NULL }
+};
+
+int luaopen_memory (lua_State *L)
+{
+  luaL_newlib(L, lib);
+  return 1;
+}
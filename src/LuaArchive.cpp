@@ -0,0 +1,337 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lib/lua52/lauxlib.h"
+#include "include/LuaArchive.hpp"
+
+#define ARCHIVE_MAGIC "ESPK0001"
+#define ARCHIVE_MT "LuaArchive"
+#define ARCHIVE_PATH_MAX 4096
+
+/// On disk: the header, `buckets` entries of an open addressing table
+/// (linear probing, nameLen 0 marks an empty bucket), then the names and
+/// the bytecode the entries point into. Offsets are from the file start.
+typedef struct {
+  char magic[8];
+  uint32_t count;
+  uint32_t buckets;  /* power of two, always more than count */
+} ArchiveHeader;
+
+typedef struct {
+  uint64_t hash;
+  uint32_t nameOff, nameLen;
+  uint32_t codeOff, codeLen;
+} ArchiveEntry;
+
+typedef struct {
+  const char *data;
+  size_t size;
+  const ArchiveEntry *index;
+  uint32_t mask;
+} Archive;
+
+typedef struct {
+  char *data;
+  size_t len, cap;
+} Buffer;
+
+typedef struct {
+  char *name;
+  size_t nameLen;
+  bool init;  /* from a/init.lua, gives way to a.lua */
+  Buffer code;
+} PackEntry;
+
+typedef struct {
+  PackEntry *entries;
+  size_t count, cap;
+} PackList;
+
+static void* checkAlloc (void *ptr)
+{
+  if (!ptr) {
+    fprintf(stderr, "Fatal error: Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+static uint64_t hashName (const char *p, size_t len)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (uint8_t) p[i]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static const ArchiveEntry* findEntry (Archive *a, const char *name, size_t len)
+{
+  uint64_t h = hashName(name, len);
+  for (uint32_t i = h & a->mask;; i = (i + 1) & a->mask) {
+    const ArchiveEntry *e = &a->index[i];
+    if (e->nameLen == 0) { return NULL; }
+    if (e->hash == h && e->nameLen == len && !memcmp(a->data + e->nameOff, name, len)) {
+      return e;
+    }
+  }
+}
+
+/// upvalue 1 is the Archive userdata, upvalue 2 its path
+static int searcher (lua_State *L)
+{
+  size_t len;
+  const char *name = luaL_checklstring(L, 1, &len);
+  Archive *a = (Archive*) lua_touserdata(L, lua_upvalueindex(1));
+  const ArchiveEntry *e = findEntry(a, name, len);
+  if (!e) {
+    lua_pushfstring(L, "\n\tno module " LUA_QS " in archive " LUA_QS,
+      name, lua_tostring(L, lua_upvalueindex(2)));
+    return 1;
+  }
+  /* the bytecode carries its own source name for debug info */
+  if (luaL_loadbufferx(L, a->data + e->codeOff, e->codeLen, name, "b") != LUA_OK) {
+    return luaL_error(L, "error loading module " LUA_QS " from archive " LUA_QS ":\n\t%s",
+      name, lua_tostring(L, lua_upvalueindex(2)), lua_tostring(L, -1));
+  }
+  lua_pushvalue(L, lua_upvalueindex(2));
+  return 2;
+}
+
+static int archiveGC (lua_State *L)
+{
+  Archive *a = (Archive*) luaL_checkudata(L, 1, ARCHIVE_MT);
+  if (a->data) {
+    munmap((void*) a->data, a->size);
+    a->data = NULL;
+  }
+  return 0;
+}
+
+static bool validArchive (const char *data, size_t size)
+{
+  const ArchiveHeader *h = (const ArchiveHeader*) data;
+  if (size < sizeof(ArchiveHeader) || memcmp(h->magic, ARCHIVE_MAGIC, sizeof(h->magic))) {
+    return false;
+  }
+  if (h->buckets == 0 || (h->buckets & (h->buckets - 1)) || h->count >= h->buckets ||
+      h->buckets > (size - sizeof(ArchiveHeader)) / sizeof(ArchiveEntry)) {
+    return false;
+  }
+  const ArchiveEntry *index = (const ArchiveEntry*) (data + sizeof(ArchiveHeader));
+  for (uint32_t i = 0; i < h->buckets; i++) {
+    const ArchiveEntry *e = &index[i];
+    if (e->nameLen == 0) { continue; }
+    if ((uint64_t) e->nameOff + e->nameLen > size || (uint64_t) e->codeOff + e->codeLen > size) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool LuaArchiveOpen (lua_State *L, const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) { return false; }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(ArchiveHeader)) {
+    close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) { return false; }
+  if (!validArchive((const char*) data, size)) {
+    munmap(data, size);
+    return false;
+  }
+
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "searchers");
+  Archive *a = (Archive*) lua_newuserdata(L, sizeof(Archive));
+  a->data = (const char*) data;
+  a->size = size;
+  a->index = (const ArchiveEntry*) (a->data + sizeof(ArchiveHeader));
+  a->mask = ((const ArchiveHeader*) data)->buckets - 1;
+  if (luaL_newmetatable(L, ARCHIVE_MT)) {
+    lua_pushcfunction(L, archiveGC);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  lua_pushstring(L, path);
+  lua_pushcclosure(L, searcher, 2);
+
+  /* right after the preload searcher, ahead of anything touching files */
+  int n = lua_rawlen(L, -2);
+  for (int i = n; i >= 2; i--) {
+    lua_rawgeti(L, -2, i);
+    lua_rawseti(L, -3, i + 1);
+  }
+  lua_rawseti(L, -2, 2);
+  lua_pop(L, 2);
+  return true;
+}
+
+static int dumpWriter (lua_State *L, const void *p, size_t len, void *ud)
+{
+  (void) L;
+  Buffer *buf = (Buffer*) ud;
+  if (buf->len + len > buf->cap) {
+    buf->cap = (buf->len + len) * 2;
+    buf->data = (char*) checkAlloc(realloc(buf->data, buf->cap));
+  }
+  memcpy(buf->data + buf->len, p, len);
+  buf->len += len;
+  return 0;
+}
+
+static void addEntry (PackList *list, char *name, size_t nameLen, bool init, Buffer code)
+{
+  for (size_t i = 0; i < list->count; i++) {
+    PackEntry *e = &list->entries[i];
+    if (e->nameLen != nameLen || memcmp(e->name, name, nameLen)) { continue; }
+    if (e->init && !init) {
+      free(e->code.data);
+      e->code = code;
+      e->init = false;
+    } else {
+      free(code.data);
+    }
+    free(name);
+    return;
+  }
+  if (list->count == list->cap) {
+    list->cap = list->cap ? list->cap * 2 : 64;
+    list->entries = (PackEntry*) checkAlloc(realloc(list->entries, list->cap * sizeof(PackEntry)));
+  }
+  list->entries[list->count++] = (PackEntry) { name, nameLen, init, code };
+}
+
+/// compiles path, rootLen is the length of the archive's root with its slash
+static bool packFile (lua_State *L, PackList *list, const char *path, size_t rootLen)
+{
+  if (luaL_loadfile(L, path) != LUA_OK) { return false; }
+  Buffer code = { NULL, 0, 0 };
+  lua_dump(L, dumpWriter, &code);
+  lua_pop(L, 1);
+
+  /* a/b.lua -> a.b, a/init.lua -> a */
+  size_t len = strlen(path) - rootLen - 4;
+  char *name = (char*) checkAlloc(malloc(len + 1));
+  memcpy(name, path + rootLen, len);
+  name[len] = '\0';
+  for (char *p = name; *p; p++) {
+    if (*p == '/') { *p = '.'; }
+  }
+  bool init = len > 5 && !strcmp(name + len - 5, ".init");
+  if (init) {
+    len -= 5;
+    name[len] = '\0';
+  }
+  addEntry(list, name, len, init, code);
+  return true;
+}
+
+static bool packDir (lua_State *L, PackList *list, char *path, size_t rootLen)
+{
+  DIR *dir = opendir(path);
+  if (!dir) {
+    lua_pushfstring(L, "cannot open %s", path);
+    return false;
+  }
+  size_t len = strlen(path);
+  bool ok = true;
+  struct dirent *ent;
+  while (ok && (ent = readdir(dir))) {
+    if (ent->d_name[0] == '.') { continue; }
+    size_t nameLen = strlen(ent->d_name);
+    if (len + 1 + nameLen >= ARCHIVE_PATH_MAX) { continue; }
+    path[len] = '/';
+    memcpy(path + len + 1, ent->d_name, nameLen + 1);
+    struct stat st;
+    if (stat(path, &st) != 0) { continue; }
+    if (S_ISDIR(st.st_mode)) {
+      ok = packDir(L, list, path, rootLen);
+    } else if (S_ISREG(st.st_mode) && nameLen > 4 && !strcmp(ent->d_name + nameLen - 4, ".lua")) {
+      ok = packFile(L, list, path, rootLen);
+    }
+  }
+  path[len] = '\0';
+  closedir(dir);
+  return ok;
+}
+
+static bool writeArchive (PackList *list, const char *out)
+{
+  uint32_t buckets = 1;
+  while (buckets <= list->count * 2) { buckets *= 2; }
+  ArchiveEntry *index = (ArchiveEntry*) checkAlloc(calloc(buckets, sizeof(ArchiveEntry)));
+  size_t nameOff = sizeof(ArchiveHeader) + buckets * sizeof(ArchiveEntry);
+  size_t codeOff = nameOff;
+  for (size_t i = 0; i < list->count; i++) {
+    codeOff += list->entries[i].nameLen;
+  }
+  for (size_t i = 0; i < list->count; i++) {
+    PackEntry *e = &list->entries[i];
+    uint64_t h = hashName(e->name, e->nameLen);
+    uint32_t b = h & (buckets - 1);
+    while (index[b].nameLen) { b = (b + 1) & (buckets - 1); }
+    index[b] = (ArchiveEntry) { h, (uint32_t) nameOff, (uint32_t) e->nameLen,
+                                (uint32_t) codeOff, (uint32_t) e->code.len };
+    nameOff += e->nameLen;
+    codeOff += e->code.len;
+  }
+
+  ArchiveHeader header;
+  memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+  header.count = list->count;
+  header.buckets = buckets;
+
+  char tmp[ARCHIVE_PATH_MAX + 8];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", out);
+  FILE *fp = fopen(tmp, "wb");
+  bool ok = fp && codeOff <= UINT32_MAX;
+  ok = ok && fwrite(&header, sizeof(header), 1, fp) == 1;
+  ok = ok && fwrite(index, sizeof(ArchiveEntry), buckets, fp) == buckets;
+  for (size_t i = 0; ok && i < list->count; i++) {
+    PackEntry *e = &list->entries[i];
+    ok = fwrite(e->name, 1, e->nameLen, fp) == e->nameLen;
+  }
+  for (size_t i = 0; ok && i < list->count; i++) {
+    PackEntry *e = &list->entries[i];
+    ok = fwrite(e->code.data, 1, e->code.len, fp) == e->code.len;
+  }
+  if (fp) { ok = fclose(fp) == 0 && ok; }
+  if (ok) { ok = rename(tmp, out) == 0; }
+  if (!ok) { remove(tmp); }
+  free(index);
+  return ok;
+}
+
+bool LuaArchivePack (lua_State *L, const char *dir, const char *out)
+{
+  char path[ARCHIVE_PATH_MAX];
+  snprintf(path, sizeof(path), "%s", dir);
+  size_t rootLen = strlen(path);
+  while (rootLen > 1 && path[rootLen - 1] == '/') { path[--rootLen] = '\0'; }
+
+  PackList list = { NULL, 0, 0 };
+  bool ok = packDir(L, &list, path, rootLen + 1);
+  if (ok) {
+    ok = writeArchive(&list, out);
+    if (!ok) { lua_pushfstring(L, "cannot write %s", out); }
+  }
+  for (size_t i = 0; i < list.count; i++) {
+    free(list.entries[i].name);
+    free(list.entries[i].code.data);
+  }
+  free(list.entries);
+  return ok;
+}
@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "lib/lua52/lauxlib.h"
+#include "include/LuaCache.hpp"
+
+#define CACHE_MAGIC "ESLC0002"
+#define CACHE_PATH_MAX 4096
+/// "/<16 hex digits>.luac" after the cache dir
+#define CACHE_NAME_MAX 32
+
+/// what the cached bytecode was compiled from, followed by
+/// the source path and the bytecode
+typedef struct {
+  char magic[8];
+  int64_t mtime;  /* nanoseconds, saves within a second still differ */
+  int64_t size;
+  uint64_t hash;
+  uint32_t pathLen;
+  uint32_t codeLen;
+} CacheHeader;
+
+typedef struct {
+  char *data;
+  size_t len, cap;
+} Buffer;
+
+static char cacheDir[CACHE_PATH_MAX];
+static LuaCacheStats stats;
+
+static void* checkAlloc (void *ptr)
+{
+  if (!ptr) {
+    fprintf(stderr, "Fatal error: Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+static uint64_t hashBytes (const char *p, size_t len, uint64_t h)
+{
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (uint8_t) p[i]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static int64_t modifiedTime (const struct stat *st)
+{
+#if defined(__APPLE__)
+  return (int64_t) st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#else
+  return (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#endif
+}
+
+static bool readFile (const char *path, Buffer *buf)
+{
+  FILE *fp = fopen(path, "rb");
+  if (!fp) { return false; }
+  fseek(fp, 0, SEEK_END);
+  long len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  buf->data = (char*) checkAlloc(malloc(len > 0 ? len : 1));
+  buf->len = buf->cap = len;
+  bool ok = len >= 0 && fread(buf->data, 1, len, fp) == (size_t) len;
+  fclose(fp);
+  if (!ok) { free(buf->data); buf->data = NULL; }
+  return ok;
+}
+
+static int dumpWriter (lua_State *L, const void *p, size_t len, void *ud)
+{
+  (void) L;
+  Buffer *buf = (Buffer*) ud;
+  if (buf->len + len > buf->cap) {
+    buf->cap = (buf->len + len) * 2;
+    buf->data = (char*) checkAlloc(realloc(buf->data, buf->cap));
+  }
+  memcpy(buf->data + buf->len, p, len);
+  buf->len += len;
+  return 0;
+}
+
+/// written to a temporary name first, a crash never leaves half a file
+static bool writeCache (const char *cachePath, CacheHeader *h, const char *path,
+                        const char *code)
+{
+  char tmp[CACHE_PATH_MAX + CACHE_NAME_MAX + 8];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", cachePath);
+  FILE *fp = fopen(tmp, "wb");
+  if (!fp) { return false; }
+  bool ok = fwrite(h, sizeof(*h), 1, fp) == 1 &&
+            fwrite(path, 1, h->pathLen, fp) == h->pathLen &&
+            fwrite(code, 1, h->codeLen, fp) == h->codeLen;
+  ok = fclose(fp) == 0 && ok;
+  if (ok) { ok = rename(tmp, cachePath) == 0; }
+  if (!ok) { remove(tmp); }
+  return ok;
+}
+
+/// pushes the chunk of the module at path, returns a lua_load status
+static int loadModule (lua_State *L, const char *path)
+{
+  struct stat st;
+  if (stat(path, &st) != 0) { return luaL_loadfile(L, path); }
+
+  size_t pathLen = strlen(path);
+  int64_t mtime = modifiedTime(&st);
+  char cachePath[CACHE_PATH_MAX + CACHE_NAME_MAX];
+  snprintf(cachePath, sizeof(cachePath), "%s/%016llx.luac", cacheDir,
+    (unsigned long long) hashBytes(path, pathLen, 0xcbf29ce484222325ULL));
+
+  Buffer cache = { NULL, 0, 0 };
+  Buffer source = { NULL, 0, 0 };
+  CacheHeader *h = NULL;
+  const char *code = NULL;
+  if (readFile(cachePath, &cache) && cache.len >= sizeof(CacheHeader)) {
+    h = (CacheHeader*) cache.data;
+    bool valid = !memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) &&
+      cache.len == sizeof(CacheHeader) + h->pathLen + h->codeLen &&
+      h->pathLen == pathLen && !memcmp(cache.data + sizeof(CacheHeader), path, pathLen);
+    code = cache.data + sizeof(CacheHeader) + pathLen;
+    if (!valid) { h = NULL; }
+  }
+
+  /* same mtime and size, the source isn't even read */
+  bool fresh = h && h->mtime == mtime && h->size == (int64_t) st.st_size;
+  uint64_t hash = 0;
+  if (!fresh) {
+    if (!readFile(path, &source)) {
+      free(cache.data);
+      return luaL_loadfile(L, path);
+    }
+    hash = hashBytes(source.data, source.len, 0xcbf29ce484222325ULL);
+    /* touched but unchanged (checkout, copy), only the header is stale */
+    if (h && h->hash == hash && h->size == (int64_t) source.len) {
+      h->mtime = mtime;
+      writeCache(cachePath, h, path, code);
+      fresh = true;
+    }
+  }
+
+  if (fresh) {
+    char chunkname[CACHE_PATH_MAX + 1];
+    snprintf(chunkname, sizeof(chunkname), "@%s", path);
+    int status = luaL_loadbufferx(L, code, h->codeLen, chunkname, "b");
+    if (status == LUA_OK) {
+      stats.hits++;
+      free(cache.data);
+      free(source.data);
+      return status;
+    }
+    /* built by another Lua version or damaged, parse the source again */
+    lua_pop(L, 1);
+  }
+  free(cache.data);
+
+  /* luaL_loadfile skips a BOM and a leading # line like searcher_Lua does */
+  int status = luaL_loadfile(L, path);
+  if (status != LUA_OK) {
+    free(source.data);
+    return status;
+  }
+  stats.misses++;
+
+  if (!source.data) {
+    if (!readFile(path, &source)) { return status; }
+    hash = hashBytes(source.data, source.len, 0xcbf29ce484222325ULL);
+  }
+  Buffer dump = { NULL, 0, 0 };
+  lua_dump(L, dumpWriter, &dump);
+  CacheHeader header;
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.mtime = mtime;
+  header.size = source.len;
+  header.hash = hash;
+  header.pathLen = pathLen;
+  header.codeLen = dump.len;
+  if (!writeCache(cachePath, &header, path, dump.data)) { stats.failures++; }
+  free(dump.data);
+  free(source.data);
+  return status;
+}
+
+/// drop-in for searcher_Lua, upvalue 1 is the package table
+static int searcher (lua_State *L)
+{
+  const char *name = luaL_checkstring(L, 1);
+  lua_getfield(L, lua_upvalueindex(1), "searchpath");
+  lua_pushstring(L, name);
+  lua_getfield(L, lua_upvalueindex(1), "path");
+  if (!lua_isstring(L, -1)) {
+    luaL_error(L, LUA_QL("package.path") " must be a string");
+  }
+  lua_call(L, 2, 2);
+  if (lua_isnil(L, -2)) { return 1; }  /* not found, error message on top */
+  lua_pop(L, 1);
+
+  const char *path = lua_tostring(L, -1);
+  if (loadModule(L, path) != LUA_OK) {
+    return luaL_error(L, "error loading module " LUA_QS " from file " LUA_QS ":\n\t%s",
+      name, path, lua_tostring(L, -1));
+  }
+  lua_pushstring(L, path);
+  return 2;
+}
+
+void LuaCacheInit (lua_State *L, const char *dir)
+{
+  /* a cut dir would put the cache somewhere else, go without one */
+  if (snprintf(cacheDir, sizeof(cacheDir), "%s", dir) >= (int) sizeof(cacheDir)) {
+    cacheDir[0] = '\0';
+    return;
+  }
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "searchers");
+  lua_pushvalue(L, -2);
+  lua_pushcclosure(L, searcher, 1);
+  /* the Lua file searcher comes right after the preload one */
+  lua_rawseti(L, -2, 2);
+  lua_pop(L, 2);
+}
+
+void LuaCacheGetStats (LuaCacheStats *out)
+{
+  *out = stats;
+}
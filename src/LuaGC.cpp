@@ -0,0 +1,146 @@
+#include <string.h>
+#include "lib/lua52/lauxlib.h"
+#include "include/LuaGC.hpp"
+#include "include/Scheduler.hpp"
+
+/// work asked of a single LUA_GCSTEP, in KB of allocation it pays for
+#define STEP_KB 16
+/// Lua's own pause, in percent. Lua fixes the next threshold when a cycle
+/// ends, and that is usually outside a frame, so the pause stays raised
+/// for good. Lua then starts a cycle on its own only when a frame
+/// allocates wildly.
+#define FRAME_PAUSE 1000
+/// a new cycle starts once the heap has grown by this percentage
+#define CYCLE_PAUSE 200
+
+static lua_State *L;
+static size_t ceiling;
+static bool cycleRunning;
+static bool stopped;
+/// heap size in KB after the last finished cycle
+static int liveKB;
+static LuaGCStats stats;
+
+static void recordPause (double t)
+{
+  stats.total += t;
+  stats.max = t > stats.max ? t : stats.max;
+  stats.history[stats.count % LUAGC_HISTORY] = t;
+  stats.count++;
+}
+
+static int heapKB (void)
+{
+  return lua_gc(L, LUA_GCCOUNT, 0);
+}
+
+/// true when the heap crossed the ceiling and was collected
+static bool enforceCeiling (void)
+{
+  if (ceiling == 0 || (size_t) heapKB() * 1024 < ceiling) { return false; }
+  double start = SchedTime();
+  lua_gc(L, LUA_GCCOLLECT, 0);
+  recordPause(SchedTime() - start);
+  stats.forced++;
+  cycleRunning = false;
+  liveKB = heapKB();
+  return true;
+}
+
+static bool wantsWork (void)
+{
+  return cycleRunning || heapKB() >= (long) liveKB * CYCLE_PAUSE / 100;
+}
+
+/// steps until the deadline, leaving room for one more step
+/// so a slice doesn't run over it
+static bool stepTask (void *udata, double deadline)
+{
+  (void) udata;
+  if (enforceCeiling()) { return false; }
+
+  double last = 0;
+  while (wantsWork() && SchedTime() + last < deadline) {
+    double start = SchedTime();
+    cycleRunning = !lua_gc(L, LUA_GCSTEP, STEP_KB);
+    last = SchedTime() - start;
+    recordPause(last);
+    stats.steps++;
+    if (!cycleRunning) {
+      stats.cycles++;
+      liveKB = heapKB();
+    }
+  }
+  return wantsWork();
+}
+
+void LuaGCInit (lua_State *state, size_t bytes)
+{
+  L = state;
+  ceiling = bytes;
+  cycleRunning = false;
+  stopped = false;
+  liveKB = heapKB();
+  memset(&stats, 0, sizeof(stats));
+  lua_gc(L, LUA_GCSETPAUSE, FRAME_PAUSE);
+}
+
+/// the pause only delays the start of a cycle, one under way would keep
+/// stepping on every allocation, so it is stopped until the frame is done
+void LuaGCBeginFrame (void)
+{
+  if (cycleRunning) {
+    lua_gc(L, LUA_GCSTOP, 0);
+    stopped = true;
+  }
+}
+
+void LuaGCEndFrame (void)
+{
+  if (stopped) {
+    lua_gc(L, LUA_GCRESTART, 0);
+    stopped = false;
+  }
+  enforceCeiling();
+  if (wantsWork()) { SchedAdd(SCHED_GC, stepTask, NULL); }
+}
+
+void LuaGCGetStats (LuaGCStats *out)
+{
+  *out = stats;
+}
+
+/// Lua module
+
+/// gc.get_stats() -> { steps, cycles, forced, total, max, pauses = { oldest first } }
+static int getStats (lua_State *L)
+{
+  LuaGCStats s;
+  LuaGCGetStats(&s);
+  size_t kept = s.count < LUAGC_HISTORY ? s.count : LUAGC_HISTORY;
+
+  lua_createtable(L, 0, 6);
+  lua_pushunsigned(L, s.steps);   lua_setfield(L, -2, "steps");
+  lua_pushunsigned(L, s.cycles);  lua_setfield(L, -2, "cycles");
+  lua_pushunsigned(L, s.forced);  lua_setfield(L, -2, "forced");
+  lua_pushnumber(L, s.total);     lua_setfield(L, -2, "total");
+  lua_pushnumber(L, s.max);       lua_setfield(L, -2, "max");
+  lua_createtable(L, kept, 0);
+  for (size_t i = 0; i < kept; i++) {
+    lua_pushnumber(L, s.history[(s.count - kept + i) % LUAGC_HISTORY]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "pauses");
+  return 1;
+}
+
+static const luaL_Reg lib[] = {
+  { "get_stats",  getStats },
+  { NULL, NULL }
+};
+
+int luaopen_gc (lua_State *L)
+{
+  luaL_newlib(L, lib);
+  return 1;
+}
@@ -0,0 +1,334 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+#include "lib/lua52/lauxlib.h"
+#include "include/LuaProfiler.hpp"
+#include "include/Scheduler.hpp"
+
+/// innermost frames kept per sample, deeper stacks get a "..." root
+#define STACK_DEPTH_MAX 32
+/// "name (short_src:line)", short_src alone can take LUA_IDSIZE
+#define FRAME_LEN 96
+/// half a second at 1 kHz, a full ring is drained right in the hook
+#define RING_SIZE 512
+
+typedef struct {
+  int depth;
+  bool truncated;
+  char frames[STACK_DEPTH_MAX][FRAME_LEN];  /* [0] is the innermost */
+} Sample;
+
+typedef struct {
+  char *stack;
+  uint64_t hash;
+  size_t count;
+} Folded;
+
+static lua_State *profL;
+static volatile sig_atomic_t running;
+static struct sigaction oldAction;
+/// the hook sampleHook displaces while armed (LuaAlloc's tag hook)
+static lua_Hook restHook;
+static int restMask, restCount;
+
+static Sample *ring;
+static int ringHead, ringCount;
+
+static Folded *table;
+static size_t tableCap;
+static LuaProfStats stats;
+
+static void* checkAlloc (void *ptr)
+{
+  if (!ptr) {
+    fprintf(stderr, "Fatal error: Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+static uint64_t hashString (const char *p, size_t len)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (uint8_t) p[i]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+/// Aggregation
+
+static Folded* findSlot (Folded *slots, size_t cap, const char *stack, size_t len, uint64_t hash)
+{
+  for (size_t i = hash & (cap - 1);; i = (i + 1) & (cap - 1)) {
+    Folded *f = &slots[i];
+    if (!f->stack) { return f; }
+    if (f->hash == hash && !strncmp(f->stack, stack, len) && f->stack[len] == '\0') {
+      return f;
+    }
+  }
+}
+
+static void growTable (void)
+{
+  size_t cap = tableCap ? tableCap * 2 : 1024;
+  Folded *slots = (Folded*) checkAlloc(calloc(cap, sizeof(Folded)));
+  for (size_t i = 0; i < tableCap; i++) {
+    Folded *f = &table[i];
+    if (f->stack) { *findSlot(slots, cap, f->stack, strlen(f->stack), f->hash) = *f; }
+  }
+  free(table);
+  table = slots;
+  tableCap = cap;
+}
+
+static void addStack (const char *stack, size_t len)
+{
+  if ((stats.stacks + 1) * 4 > tableCap * 3) { growTable(); }
+  uint64_t hash = hashString(stack, len);
+  Folded *f = findSlot(table, tableCap, stack, len, hash);
+  if (!f->stack) {
+    f->stack = (char*) checkAlloc(malloc(len + 1));
+    memcpy(f->stack, stack, len + 1);
+    f->hash = hash;
+    stats.stacks++;
+  }
+  f->count++;
+  stats.samples++;
+}
+
+/// folds the oldest sample of the ring root first, "a;b;c"
+static void foldSample (void)
+{
+  static char buf[(STACK_DEPTH_MAX + 1) * (FRAME_LEN + 1)];
+  Sample *s = &ring[ringHead];
+  size_t len = 0;
+  if (s->truncated) {
+    memcpy(buf, "...;", 4);
+    len = 4;
+  }
+  for (int i = s->depth - 1; i >= 0; i--) {
+    for (const char *p = s->frames[i]; *p; p++) {
+      buf[len++] = *p == ';' ? ':' : *p;
+    }
+    buf[len++] = ';';
+  }
+  buf[--len] = '\0';
+  addStack(buf, len);
+  ringHead = (ringHead + 1) % RING_SIZE;
+  ringCount--;
+}
+
+static bool drainTask (void *udata, double deadline)
+{
+  (void) udata;
+  while (ringCount > 0) {
+    for (int i = 0; i < 16 && ringCount > 0; i++) { foldSample(); }
+    if (SchedTime() >= deadline) { break; }
+  }
+  return ringCount > 0;
+}
+
+static void drain (void)
+{
+  while (ringCount > 0) { foldSample(); }
+}
+
+/// Sampling
+
+static void formatFrame (char *out, lua_Debug *ar)
+{
+  const char *name = ar->name ? ar->name : "?";
+  if (*ar->what == 'C') {
+    snprintf(out, FRAME_LEN, "%s [C]", name);
+  } else if (*ar->what == 'm') {
+    snprintf(out, FRAME_LEN, "main chunk (%s)", ar->short_src);
+  } else {
+    snprintf(out, FRAME_LEN, "%s (%s:%d)", name, ar->short_src, ar->linedefined);
+  }
+}
+
+/// armed by the signal handler, fires once on the next instruction
+static void sampleHook (lua_State *L, lua_Debug *ar)
+{
+  (void) ar;
+  lua_sethook(L, restHook, restMask, restCount);
+  if (!running) { return; }
+  /* the scheduler didn't get to run, pay for folding here */
+  if (ringCount == RING_SIZE) { drain(); }
+
+  Sample *s = &ring[(ringHead + ringCount) % RING_SIZE];
+  lua_Debug d;
+  int depth = 0;
+  while (depth < STACK_DEPTH_MAX && lua_getstack(L, depth, &d)) {
+    lua_getinfo(L, "Sn", &d);
+    formatFrame(s->frames[depth], &d);
+    depth++;
+  }
+  if (depth == 0) {
+    stats.dropped++;
+    return;
+  }
+  s->depth = depth;
+  s->truncated = depth == STACK_DEPTH_MAX && lua_getstack(L, depth, &d);
+  if (++ringCount == 1) { SchedAdd(SCHED_PROFILE, drainTask, NULL); }
+}
+
+/// lua_sethook is the one Lua call that is safe from a signal handler,
+/// the lua_gethook* ones only read the same fields
+static void onSignal (int sig)
+{
+  (void) sig;
+  if (!running || lua_gethook(profL) == sampleHook) { return; }
+  restHook = lua_gethook(profL);
+  restMask = lua_gethookmask(profL);
+  restCount = lua_gethookcount(profL);
+  lua_sethook(profL, sampleHook, LUA_MASKCOUNT, 1);
+}
+
+static void setTimer (int hz)
+{
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  if (hz > 0) {
+    timer.it_interval.tv_usec = 1000000 / hz;
+    timer.it_value = timer.it_interval;
+  }
+  setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+bool LuaProfStart (lua_State *L, int hz)
+{
+  if (running || hz <= 0 || hz > 1000000) { return false; }
+  if (!ring) { ring = (Sample*) checkAlloc(malloc(RING_SIZE * sizeof(Sample))); }
+  profL = L;
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onSignal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, &oldAction) != 0) { return false; }
+  running = 1;
+  setTimer(hz);
+  return true;
+}
+
+/// samples already taken stay queued for the scheduler or LuaProfWrite
+void LuaProfStop (void)
+{
+  if (!running) { return; }
+  running = 0;
+  setTimer(0);
+  sigaction(SIGPROF, &oldAction, NULL);
+  if (lua_gethook(profL) == sampleHook) {
+    lua_sethook(profL, restHook, restMask, restCount);
+  }
+}
+
+bool LuaProfRunning (void)
+{
+  return running;
+}
+
+bool LuaProfWrite (const char *path)
+{
+  drain();
+  FILE *fp = fopen(path, "w");
+  if (!fp) { return false; }
+  for (size_t i = 0; i < tableCap; i++) {
+    if (table[i].stack) { fprintf(fp, "%s %zu\n", table[i].stack, table[i].count); }
+  }
+  return fclose(fp) == 0;
+}
+
+void LuaProfReset (void)
+{
+  ringHead = ringCount = 0;
+  SchedRemove(drainTask, NULL);
+  for (size_t i = 0; i < tableCap; i++) { free(table[i].stack); }
+  free(table);
+  table = NULL;
+  tableCap = 0;
+  memset(&stats, 0, sizeof(stats));
+}
+
+void LuaProfGetStats (LuaProfStats *out)
+{
+  drain();
+  *out = stats;
+}
+
+/// Lua module
+
+static int start (lua_State *L)
+{
+  int hz = luaL_optint(L, 1, 1000);
+  luaL_argcheck(L, hz > 0 && hz <= 1000000, 1, "rate out of range");
+  /* hooks are per thread, samples are taken on the main one */
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+  lua_State *main = lua_tothread(L, -1);
+  lua_pop(L, 1);
+  lua_pushboolean(L, LuaProfStart(main, hz));
+  return 1;
+}
+
+static int stop (lua_State *L)
+{
+  (void) L;
+  LuaProfStop();
+  return 0;
+}
+
+static int isRunning (lua_State *L)
+{
+  lua_pushboolean(L, LuaProfRunning());
+  return 1;
+}
+
+static int writeProfile (lua_State *L)
+{
+  const char *path = luaL_checkstring(L, 1);
+  if (!LuaProfWrite(path)) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "cannot write '%s'", path);
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+static int reset (lua_State *L)
+{
+  (void) L;
+  LuaProfReset();
+  return 0;
+}
+
+static int getStats (lua_State *L)
+{
+  LuaProfStats s;
+  LuaProfGetStats(&s);
+  lua_pushunsigned(L, s.samples);
+  lua_pushunsigned(L, s.stacks);
+  lua_pushunsigned(L, s.dropped);
+  return 3;
+}
+
+static const luaL_Reg lib[] = {
+  { "start",      start        },
+  { "stop",       stop         },
+  { "running",    isRunning    },
+  { "write",      writeProfile },
+  { "reset",      reset        },
+  { "get_stats",  getStats     },
+  { NULL, NULL }
+};
+
+int luaopen_profiler (lua_State *L)
+{
+  luaL_newlib(L, lib);
+  return 1;
+}
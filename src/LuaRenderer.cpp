@@ -0,0 +1,520 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "lib/lua52/lauxlib.h"
+#include "include/LuaRenderer.hpp"
+#include "include/Renderer.hpp"
+
+#define FONT_META "renderer.font"
+#define IMAGE_META "renderer.image"
+#define BATCH_META "renderer.batch"
+
+#define FONT_STATS_MAX 1024
+
+typedef struct { RFont *font; } LuaFont;
+typedef struct { RImage *image; int width, height; } LuaImage;
+
+/// commands recorded from Lua, kept between submits so a batch
+/// reused every frame stops allocating once it has grown
+typedef struct {
+  RRectCmd *rects;
+  int rectCount, rectCap;
+  RImageCmd *images;
+  int imageCount, imageCap;
+} LuaBatch;
+
+static const char *const formats[] = { "straight", "premultiplied", "subpixel", NULL };
+static const char *const modes[] = { "grayscale", "subpixel", NULL };
+static const char *const filters[] = { "nearest", "bilinear", "box", NULL };
+
+static void* checkAlloc (void *ptr)
+{
+  if (!ptr) {
+    fprintf(stderr, "Fatal error: Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+/// Arguments
+
+static inline RColor toColor (lua_Unsigned c)
+{
+  return (RColor) { (uint8_t) (c >> 24), (uint8_t) (c >> 16), (uint8_t) (c >> 8), (uint8_t) c };
+}
+
+static inline RColor optColor (lua_State *L, int idx)
+{
+  return toColor(luaL_optunsigned(L, idx, 0xffffffff));
+}
+
+static inline RRect checkRect (lua_State *L, int idx)
+{
+  return (RRect) {
+    (int) luaL_checkinteger(L, idx),     (int) luaL_checkinteger(L, idx + 1),
+    (int) luaL_checkinteger(L, idx + 2), (int) luaL_checkinteger(L, idx + 3)
+  };
+}
+
+/// the source rect of an image command must lie inside the image
+static inline bool subInside (const RRect *sub, const LuaImage *img)
+{
+  return sub->x >= 0 && sub->y >= 0 && sub->width >= 0 && sub->height >= 0 &&
+    sub->x <= img->width - sub->width && sub->y <= img->height - sub->height;
+}
+
+static RFont* checkFont (lua_State *L, int idx)
+{
+  LuaFont *f = (LuaFont*) luaL_checkudata(L, idx, FONT_META);
+  luaL_argcheck(L, f->font, idx, "font was freed");
+  return f->font;
+}
+
+static LuaImage* checkImage (lua_State *L, int idx)
+{
+  LuaImage *img = (LuaImage*) luaL_checkudata(L, idx, IMAGE_META);
+  luaL_argcheck(L, img->image, idx, "image was freed");
+  return img;
+}
+
+/// Window and frame
+
+/// renderer.color(r, g, b [, a]) -> packed color
+static int color (lua_State *L)
+{
+  lua_Unsigned r = luaL_checkunsigned(L, 1) & 0xff;
+  lua_Unsigned g = luaL_checkunsigned(L, 2) & 0xff;
+  lua_Unsigned b = luaL_checkunsigned(L, 3) & 0xff;
+  lua_Unsigned a = luaL_optunsigned(L, 4, 0xff) & 0xff;
+  lua_pushunsigned(L, r << 24 | g << 16 | b << 8 | a);
+  return 1;
+}
+
+static int setScale (lua_State *L)
+{
+  float scale = luaL_checknumber(L, 1);
+  luaL_argcheck(L, scale > 0, 1, "scale must be positive");
+  RSetScale(scale);
+  return 0;
+}
+
+static int setClipRect (lua_State *L)
+{
+  RSetClipRect(checkRect(L, 1));
+  return 0;
+}
+
+static int pushClipRect (lua_State *L)
+{
+  RRect rect = checkRect(L, 1);
+  if (RGetClipDepth() == R_CLIP_STACK_MAX) {
+    return luaL_error(L, "clip rects nested deeper than %d", R_CLIP_STACK_MAX);
+  }
+  RPushClipRect(rect);
+  return 0;
+}
+
+static int popClipRect (lua_State *L)
+{
+  if (RGetClipDepth() == 0) { return luaL_error(L, "no clip rect to pop"); }
+  RPopClipRect();
+  return 0;
+}
+
+static int getSize (lua_State *L)
+{
+  int w, h;
+  float scale;
+  RGetSize(&w, &h, &scale);
+  lua_pushinteger(L, w);
+  lua_pushinteger(L, h);
+  lua_pushnumber(L, scale);
+  return 3;
+}
+
+/// renderer.update_rects([x, y, w, h, ...]), no rects presents the whole window
+static int updateRects (lua_State *L)
+{
+  RRect rects[64];
+  int n = lua_gettop(L) / 4;
+  luaL_argcheck(L, n <= 64, 1, "too many rects");
+  for (int i = 0; i < n; i++) { rects[i] = checkRect(L, i * 4 + 1); }
+  if (n == 0) {
+    RGetSize(&rects[0].width, &rects[0].height, NULL);
+    rects[0].x = rects[0].y = 0;
+    n = 1;
+  }
+  RUpdateRects(rects, n);
+  return 0;
+}
+
+static int setPresentDiffing (lua_State *L)
+{
+  RSetPresentDiffing(lua_toboolean(L, 1));
+  return 0;
+}
+
+static int setTextBlending (lua_State *L)
+{
+  RSetTextBlending(lua_toboolean(L, 1), luaL_optnumber(L, 2, 0), luaL_optnumber(L, 3, 0));
+  return 0;
+}
+
+/// renderer.set_line_cache_budget(bytes), 0 disables the cache
+static int setLineCacheBudget (lua_State *L)
+{
+  lua_Integer bytes = luaL_checkinteger(L, 1);
+  luaL_argcheck(L, bytes >= 0, 1, "budget must not be negative");
+  RSetLineCacheBudget((size_t) bytes);
+  return 0;
+}
+
+/// Drawing
+
+/// renderer.draw_rect(x, y, w, h [, color])
+static int drawRect (lua_State *L)
+{
+  RDrawRect(checkRect(L, 1), optColor(L, 5));
+  return 0;
+}
+
+/// renderer.draw_image(image, sx, sy, sw, sh, x, y [, color])
+static int drawImage (lua_State *L)
+{
+  LuaImage *img = checkImage(L, 1);
+  RRect sub = checkRect(L, 2);
+  luaL_argcheck(L, subInside(&sub, img), 2, "source rect outside the image");
+  RDrawImage(img->image, &sub, luaL_checkinteger(L, 6), luaL_checkinteger(L, 7), optColor(L, 8));
+  return 0;
+}
+
+/// renderer.draw_image_scaled(image, sx, sy, sw, sh, x, y, w, h [, color [, filter]])
+static int drawImageScaled (lua_State *L)
+{
+  LuaImage *img = checkImage(L, 1);
+  RRect sub = checkRect(L, 2);
+  luaL_argcheck(L, subInside(&sub, img), 2, "source rect outside the image");
+  RRect dst = checkRect(L, 6);
+  RFilter filter = (RFilter) luaL_checkoption(L, 11, "nearest", filters);
+  RDrawImageScaled(img->image, &sub, dst, optColor(L, 10), filter);
+  return 0;
+}
+
+/// renderer.draw_text(font, text, x, y [, color])
+static int drawText (lua_State *L)
+{
+  RFont *font = checkFont(L, 1);
+  const char *text = luaL_checkstring(L, 2);
+  RDrawText(font, text, luaL_checkinteger(L, 3), luaL_checkinteger(L, 4), optColor(L, 5));
+  return 0;
+}
+
+/// Fonts
+
+static int fontLoad (lua_State *L)
+{
+  const char *filename = luaL_checkstring(L, 1);
+  float size = luaL_checknumber(L, 2);
+  LuaFont *f = (LuaFont*) lua_newuserdata(L, sizeof(LuaFont));
+  f->font = NULL;
+  luaL_setmetatable(L, FONT_META);
+  f->font = RLoadFont(filename, size);
+  if (!f->font) { return luaL_error(L, "failed to load font '%s'", filename); }
+  return 1;
+}
+
+static int fontGc (lua_State *L)
+{
+  LuaFont *f = (LuaFont*) luaL_checkudata(L, 1, FONT_META);
+  if (f->font) {
+    RFreeFont(f->font);
+    f->font = NULL;
+  }
+  return 0;
+}
+
+static int fontSetAntialiasing (lua_State *L)
+{
+  RSetFontAntialiasing(checkFont(L, 1), (RAntialiasing) luaL_checkoption(L, 2, NULL, modes));
+  return 0;
+}
+
+static int fontSetTabWidth (lua_State *L)
+{
+  RSetFontTabWidth(checkFont(L, 1), luaL_checkinteger(L, 2));
+  return 0;
+}
+
+static int fontGetTabWidth (lua_State *L)
+{
+  lua_pushinteger(L, RGetFontTabWidth(checkFont(L, 1)));
+  return 1;
+}
+
+static int fontGetWidth (lua_State *L)
+{
+  RFont *font = checkFont(L, 1);
+  lua_pushinteger(L, RGetFontWidth(font, luaL_checkstring(L, 2)));
+  return 1;
+}
+
+static int fontGetHeight (lua_State *L)
+{
+  lua_pushinteger(L, RGetFontHeigh(checkFont(L, 1)));
+  return 1;
+}
+
+/// font:get_stats() -> { sets, bytes, bakes, bake_time, frame, { per set } }
+static int fontGetStats (lua_State *L)
+{
+  static RGlyphSetStats sets[FONT_STATS_MAX];
+  RFontStats stats;
+  int n = RGetFontStats(checkFont(L, 1), &stats, sets, FONT_STATS_MAX);
+
+  lua_createtable(L, n, 5);
+  lua_pushinteger(L, stats.sets);       lua_setfield(L, -2, "sets");
+  lua_pushnumber(L, stats.bytes);       lua_setfield(L, -2, "bytes");
+  lua_pushunsigned(L, stats.bakes);     lua_setfield(L, -2, "bakes");
+  lua_pushnumber(L, stats.bakeTime);    lua_setfield(L, -2, "bake_time");
+  lua_pushunsigned(L, stats.frame);     lua_setfield(L, -2, "frame");
+  for (int i = 0; i < n; i++) {
+    lua_createtable(L, 0, 8);
+    lua_pushinteger(L, sets[i].firstCodepoint); lua_setfield(L, -2, "first");
+    lua_pushnumber(L, sets[i].scale);           lua_setfield(L, -2, "scale");
+    lua_pushinteger(L, sets[i].width);          lua_setfield(L, -2, "width");
+    lua_pushinteger(L, sets[i].height);         lua_setfield(L, -2, "height");
+    lua_pushnumber(L, sets[i].bytes);           lua_setfield(L, -2, "bytes");
+    lua_pushunsigned(L, sets[i].accesses);      lua_setfield(L, -2, "accesses");
+    lua_pushunsigned(L, sets[i].lastUsed);      lua_setfield(L, -2, "last_used");
+    lua_pushnumber(L, sets[i].bakeTime);        lua_setfield(L, -2, "bake_time");
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+static int fontTrim (lua_State *L)
+{
+  RFont *font = checkFont(L, 1);
+  lua_pushnumber(L, RTrimFont(font, luaL_checkunsigned(L, 2)));
+  return 1;
+}
+
+/// Images
+
+static int imageNew (lua_State *L)
+{
+  int w = luaL_checkinteger(L, 1);
+  int h = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, w > 0 && h > 0, 1, "image size must be positive");
+  LuaImage *img = (LuaImage*) lua_newuserdata(L, sizeof(LuaImage));
+  img->image = RNewImage(w, h);
+  img->width = w;
+  img->height = h;
+  int stride;
+  RColor *pixels = RGetImagePixels(img->image, &stride, R_ORDER_RGBA);
+  memset(pixels, 0, (size_t) stride * h * sizeof(RColor));
+  luaL_setmetatable(L, IMAGE_META);
+  return 1;
+}
+
+static int imageGc (lua_State *L)
+{
+  LuaImage *img = (LuaImage*) luaL_checkudata(L, 1, IMAGE_META);
+  if (img->image) {
+    RFreeImage(img->image);
+    img->image = NULL;
+  }
+  return 0;
+}
+
+static int imageGetSize (lua_State *L)
+{
+  LuaImage *img = checkImage(L, 1);
+  lua_pushinteger(L, img->width);
+  lua_pushinteger(L, img->height);
+  return 2;
+}
+
+/// image:set_pixels(data), data holds width * height RGBA bytes,
+/// converted to the window's order when the image is drawn
+static int imageSetPixels (lua_State *L)
+{
+  LuaImage *img = checkImage(L, 1);
+  size_t len;
+  const char *data = luaL_checklstring(L, 2, &len);
+  size_t row = (size_t) img->width * sizeof(RColor);
+  luaL_argcheck(L, len == row * img->height, 2, "size doesn't match the image");
+  int stride;
+  RColor *pixels = RGetImagePixels(img->image, &stride, R_ORDER_RGBA);
+  for (int j = 0; j < img->height; j++) {
+    memcpy(pixels + j * stride, data + j * row, row);
+  }
+  return 0;
+}
+
+static int imageConvert (lua_State *L)
+{
+  LuaImage *img = checkImage(L, 1);
+  RPixelFormat format = (RPixelFormat) luaL_checkoption(L, 2, NULL, formats);
+  /* subpixel images are glyph atlases, Lua images never are one */
+  if (format == R_PIXEL_SUBPIXEL) { return luaL_error(L, "can't convert to subpixel"); }
+  RConvertImage(img->image, format);
+  return 0;
+}
+
+/// Batches
+
+static int batchNew (lua_State *L)
+{
+  LuaBatch *b = (LuaBatch*) lua_newuserdata(L, sizeof(LuaBatch));
+  memset(b, 0, sizeof(LuaBatch));
+  luaL_setmetatable(L, BATCH_META);
+  return 1;
+}
+
+static int batchGc (lua_State *L)
+{
+  LuaBatch *b = (LuaBatch*) luaL_checkudata(L, 1, BATCH_META);
+  free(b->rects);
+  free(b->images);
+  memset(b, 0, sizeof(LuaBatch));
+  return 0;
+}
+
+/// batch:rect(x, y, w, h [, color])
+static int batchRect (lua_State *L)
+{
+  LuaBatch *b = (LuaBatch*) luaL_checkudata(L, 1, BATCH_META);
+  if (b->rectCount == b->rectCap) {
+    b->rectCap = b->rectCap ? b->rectCap * 2 : 64;
+    b->rects = (RRectCmd*) checkAlloc(realloc(b->rects, b->rectCap * sizeof(RRectCmd)));
+  }
+  b->rects[b->rectCount++] = (RRectCmd) { checkRect(L, 2), optColor(L, 6) };
+  return 0;
+}
+
+/// batch:image(sx, sy, sw, sh, x, y), the source rect is checked
+/// against the image on submit
+static int batchImage (lua_State *L)
+{
+  LuaBatch *b = (LuaBatch*) luaL_checkudata(L, 1, BATCH_META);
+  RRect sub = checkRect(L, 2);
+  luaL_argcheck(L, sub.x >= 0 && sub.y >= 0 && sub.width >= 0 && sub.height >= 0, 2,
+    "negative source rect");
+  if (b->imageCount == b->imageCap) {
+    b->imageCap = b->imageCap ? b->imageCap * 2 : 64;
+    b->images = (RImageCmd*) checkAlloc(realloc(b->images, b->imageCap * sizeof(RImageCmd)));
+  }
+  RImageCmd *cmd = &b->images[b->imageCount++];
+  cmd->sub = sub;
+  cmd->x = luaL_checkinteger(L, 6);
+  cmd->y = luaL_checkinteger(L, 7);
+  return 0;
+}
+
+/// batch:submit([image [, color]]) draws the rects, then the image
+/// commands from image, and empties the batch
+static int batchSubmit (lua_State *L)
+{
+  LuaBatch *b = (LuaBatch*) luaL_checkudata(L, 1, BATCH_META);
+  LuaImage *img = NULL;
+  if (b->imageCount > 0) {
+    img = checkImage(L, 2);
+    for (int i = 0; i < b->imageCount; i++) {
+      if (!subInside(&b->images[i].sub, img)) {
+        return luaL_error(L, "image command %d: source rect outside the image", i + 1);
+      }
+    }
+  }
+  RDrawRects(b->rects, b->rectCount);
+  if (img) { RDrawImageBatch(img->image, b->images, b->imageCount, optColor(L, 3)); }
+  b->rectCount = b->imageCount = 0;
+  return 0;
+}
+
+static int batchClear (lua_State *L)
+{
+  LuaBatch *b = (LuaBatch*) luaL_checkudata(L, 1, BATCH_META);
+  b->rectCount = b->imageCount = 0;
+  return 0;
+}
+
+static int batchLen (lua_State *L)
+{
+  LuaBatch *b = (LuaBatch*) luaL_checkudata(L, 1, BATCH_META);
+  lua_pushinteger(L, b->rectCount + b->imageCount);
+  return 1;
+}
+
+/// Module
+
+static const luaL_Reg lib[] = {
+  { "color",                   color              },
+  { "set_scale",               setScale           },
+  { "set_clip_rect",           setClipRect        },
+  { "push_clip_rect",          pushClipRect       },
+  { "pop_clip_rect",           popClipRect        },
+  { "get_size",                getSize            },
+  { "update_rects",            updateRects        },
+  { "set_present_diffing",     setPresentDiffing  },
+  { "set_text_blending",       setTextBlending    },
+  { "set_line_cache_budget",   setLineCacheBudget },
+  { "draw_rect",               drawRect           },
+  { "draw_image",              drawImage          },
+  { "draw_image_scaled",       drawImageScaled    },
+  { "draw_text",               drawText           },
+  { NULL, NULL }
+};
+
+static const luaL_Reg fontLib[] = {
+  { "load",              fontLoad            },
+  { "__gc",              fontGc              },
+  { "set_antialiasing",  fontSetAntialiasing },
+  { "set_tab_width",     fontSetTabWidth     },
+  { "get_tab_width",     fontGetTabWidth     },
+  { "get_width",         fontGetWidth        },
+  { "get_height",        fontGetHeight       },
+  { "get_stats",         fontGetStats        },
+  { "trim",              fontTrim            },
+  { NULL, NULL }
+};
+
+static const luaL_Reg imageLib[] = {
+  { "new",         imageNew       },
+  { "__gc",        imageGc        },
+  { "get_size",    imageGetSize   },
+  { "set_pixels",  imageSetPixels },
+  { "convert",     imageConvert   },
+  { NULL, NULL }
+};
+
+static const luaL_Reg batchLib[] = {
+  { "new",     batchNew    },
+  { "__gc",    batchGc     },
+  { "__len",   batchLen    },
+  { "rect",    batchRect   },
+  { "image",   batchImage  },
+  { "submit",  batchSubmit },
+  { "clear",   batchClear  },
+  { NULL, NULL }
+};
+
+/// the metatable doubles as the method table and as renderer.<name>
+static void newClass (lua_State *L, const char *meta, const char *name, const luaL_Reg *funcs)
+{
+  luaL_newmetatable(L, meta);
+  luaL_setfuncs(L, funcs, 0);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  lua_setfield(L, -2, name);
+}
+
+/// RInit is not exposed, the window belongs to the C side
+int luaopen_renderer (lua_State *L)
+{
+  luaL_newlib(L, lib);
+  newClass(L, FONT_META, "font", fontLib);
+  newClass(L, IMAGE_META, "image", imageLib);
+  newClass(L, BATCH_META, "batch", batchLib);
+  return 1;
+}
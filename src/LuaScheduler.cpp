@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "lib/lua52/lauxlib.h"
+#include "include/LuaScheduler.hpp"
+#include "include/Scheduler.hpp"
+
+/// registry table, queued function -> its LuaTask
+#define TASKS_KEY "scheduler.tasks"
+
+typedef struct {
+  lua_State *L;  /* main thread, the one that added it may be gone */
+  int ref;       /* the function, in the registry */
+} LuaTask;
+
+static const char *const priorityNames[] = { "highlight", "index", NULL };
+static const SchedPriority priorities[] = { SCHED_HIGHLIGHT, SCHED_INDEX };
+
+static void* checkAlloc (void *ptr)
+{
+  if (!ptr) {
+    fprintf(stderr, "Fatal error: Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+/// pushes the function -> task table
+static void pushTasks (lua_State *L)
+{
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, TASKS_KEY);
+}
+
+static void forget (LuaTask *t)
+{
+  lua_State *L = t->L;
+  pushTasks(L);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, t->ref);
+  lua_pushnil(L);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+  luaL_unref(L, LUA_REGISTRYINDEX, t->ref);
+  free(t);
+}
+
+static bool runTask (void *udata, double deadline)
+{
+  LuaTask *t = (LuaTask*) udata;
+  lua_State *L = t->L;
+  bool more = false;
+  lua_rawgeti(L, LUA_REGISTRYINDEX, t->ref);
+  lua_pushnumber(L, deadline);
+  if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+    fprintf(stderr, "Error in scheduled task: %s\n", lua_tostring(L, -1));
+  } else {
+    more = lua_toboolean(L, -1);
+  }
+  lua_pop(L, 1);
+  if (!more) { forget(t); }
+  return more;
+}
+
+/// scheduler.add(priority, fn) -> false if the queue is full
+static int add (lua_State *L)
+{
+  SchedPriority priority = priorities[luaL_checkoption(L, 1, NULL, priorityNames)];
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  pushTasks(L);
+  lua_pushvalue(L, 2);
+  lua_rawget(L, -2);
+  if (!lua_isnil(L, -1)) {
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+  lua_pop(L, 1);
+
+  LuaTask *t = (LuaTask*) checkAlloc(malloc(sizeof(LuaTask)));
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+  t->L = lua_tothread(L, -1);
+  lua_pop(L, 1);
+  lua_pushvalue(L, 2);
+  t->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  if (!SchedAdd(priority, runTask, t)) {
+    luaL_unref(L, LUA_REGISTRYINDEX, t->ref);
+    free(t);
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  lua_pushvalue(L, 2);
+  lua_pushlightuserdata(L, t);
+  lua_rawset(L, -3);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/// scheduler.remove(fn), fn may not be queued
+static int removeTask (lua_State *L)
+{
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  pushTasks(L);
+  lua_pushvalue(L, 1);
+  lua_rawget(L, -2);
+  LuaTask *t = (LuaTask*) lua_touserdata(L, -1);
+  if (t) {
+    SchedRemove(runTask, t);
+    forget(t);
+  }
+  return 0;
+}
+
+static int getTime (lua_State *L)
+{
+  lua_pushnumber(L, SchedTime());
+  return 1;
+}
+
+static const luaL_Reg lib[] = {
+  { "add",     add        },
+  { "remove",  removeTask },
+  { "time",    getTime    },
+  { NULL, NULL }
+};
+
+int luaopen_scheduler (lua_State *L)
+{
+  luaL_newlib(L, lib);
+  return 1;
+}
@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "include/Minimap.hpp"
+
+#define MINIMAP_INIT_LINES 256
+
+struct Minimap {
+  RImage *image;
+  int columns, tabWidth;
+  int lines, capacity;
+};
+
+/// how much of a character cell a byte covers, and that as a
+/// premultiplied white pixel
+static uint8_t ink[256];
+static RColor inkPixel[256];
+
+static void* checkAlloc (void *ptr)
+{
+  if (!ptr) {
+    fprintf(stderr, "Fatal error: Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+/// x * y / 255, rounded
+static inline int mul255 (int x, int y)
+{
+  int t = x * y + 0x80;
+  return (t + (t >> 8)) >> 8;
+}
+
+static void initInk (void)
+{
+  for (int c = 0; c < 256; c++) {
+    uint8_t a;
+    if (c <= ' ' || c == 0x7f)        { a = 0x00; }
+    else if (c >= 'A' && c <= 'Z')    { a = 0xe0; }
+    else if (c >= '0' && c <= '9')    { a = 0xe0; }
+    else if (c >= 'a' && c <= 'z')    { a = 0xb0; }
+    else if (c < 0x80)                { a = 0x70; }  /* punctuation */
+    else                              { a = 0xa0; }  /* utf8 lead byte */
+    ink[c] = a;
+    inkPixel[c] = (RColor) { a, a, a, a };
+  }
+}
+
+/// the image is updated between draws, it is kept in the window's order
+static RColor* linePixels (Minimap *map, int line)
+{
+  int stride;
+  RColor *pixels = RGetImagePixels(map->image, &stride, R_ORDER_NATIVE);
+  return pixels + line * MINIMAP_LINE_HEIGHT * stride;
+}
+
+static size_t lineBytes (Minimap *map, int count)
+{
+  int stride;
+  RGetImagePixels(map->image, &stride, R_ORDER_NATIVE);
+  return (size_t) count * MINIMAP_LINE_HEIGHT * stride * sizeof(RColor);
+}
+
+static RImage* newImage (int columns, int lines)
+{
+  RImage *image = RNewImage(columns, lines * MINIMAP_LINE_HEIGHT);
+  int stride;
+  RColor *pixels = RGetImagePixels(image, &stride, R_ORDER_NATIVE);
+  memset(pixels, 0, (size_t) stride * lines * MINIMAP_LINE_HEIGHT * sizeof(RColor));
+  /* all zero, converting only changes the format */
+  RConvertImage(image, R_PIXEL_PREMULTIPLIED);
+  return image;
+}
+
+static void reserveLines (Minimap *map, int lines)
+{
+  if (lines <= map->capacity) { return; }
+  int capacity = map->capacity * 2 > lines ? map->capacity * 2 : lines;
+  RImage *image = newImage(map->columns, capacity);
+  memcpy(RGetImagePixels(image, NULL, R_ORDER_NATIVE), linePixels(map, 0), lineBytes(map, map->lines));
+  RFreeImage(map->image);
+  map->image = image;
+  map->capacity = capacity;
+}
+
+Minimap* MinimapNew (int columns, int tabWidth)
+{
+  assert(columns > 0 && tabWidth > 0);
+  if (!ink['a']) { initInk(); }
+  Minimap *map = (Minimap*) checkAlloc(calloc(1, sizeof(Minimap)));
+  map->columns = columns;
+  map->tabWidth = tabWidth;
+  map->capacity = MINIMAP_INIT_LINES;
+  map->image = newImage(columns, map->capacity);
+  return map;
+}
+
+void MinimapFree (Minimap *map)
+{
+  RFreeImage(map->image);
+  free(map);
+}
+
+void MinimapInsertLines (Minimap *map, int line, int count)
+{
+  assert(line >= 0 && line <= map->lines && count >= 0);
+  reserveLines(map, map->lines + count);
+  memmove(linePixels(map, line + count), linePixels(map, line), lineBytes(map, map->lines - line));
+  memset(linePixels(map, line), 0, lineBytes(map, count));
+  map->lines += count;
+}
+
+void MinimapRemoveLines (Minimap *map, int line, int count)
+{
+  assert(line >= 0 && count >= 0 && line + count <= map->lines);
+  int after = map->lines - line - count;
+  memmove(linePixels(map, line), linePixels(map, line + count), lineBytes(map, after));
+  /* rows past the end stay empty for the next insert */
+  memset(linePixels(map, line + after), 0, lineBytes(map, count));
+  map->lines -= count;
+}
+
+int MinimapGetLineCount (Minimap *map)
+{
+  return map->lines;
+}
+
+void MinimapSetLine (Minimap *map, int line, const char *text, const RColor *colors)
+{
+  assert(line >= 0 && line < map->lines);
+  RColor *row = linePixels(map, line);
+  int x = 0;
+
+  for (int i = 0; text[i] && x < map->columns; i++) {
+    unsigned char c = text[i];
+    /* one column per codepoint */
+    if ((c & 0xc0) == 0x80) { continue; }
+    if (c == '\t') {
+      int n = map->tabWidth - x % map->tabWidth;
+      n = n < map->columns - x ? n : map->columns - x;
+      memset(row + x, 0, n * sizeof(RColor));
+      x += n;
+      continue;
+    }
+    if (colors && ink[c]) {
+      RColor color = RNativeColor(colors[i]);
+      int a = mul255(color.a, ink[c]);
+      row[x++] = (RColor) {
+        (uint8_t) mul255(color.r, a), (uint8_t) mul255(color.g, a),
+        (uint8_t) mul255(color.b, a), (uint8_t) a
+      };
+    } else {
+      row[x++] = inkPixel[c];
+    }
+  }
+  memset(row + x, 0, (map->columns - x) * sizeof(RColor));
+
+  /* characters are blocks as high as the line */
+  int stride;
+  RGetImagePixels(map->image, &stride, R_ORDER_NATIVE);
+  for (int j = 1; j < MINIMAP_LINE_HEIGHT; j++) {
+    memcpy(row + j * stride, row, map->columns * sizeof(RColor));
+  }
+}
+
+void MinimapDraw (Minimap *map, int firstLine, RRect dst, RColor color)
+{
+  int zoom = dst.width / map->columns;
+  zoom = zoom < 1 ? 1 : zoom;
+  firstLine = firstLine < 0 ? 0 : firstLine;
+
+  int rows = dst.height / zoom;
+  int available = (map->lines - firstLine) * MINIMAP_LINE_HEIGHT;
+  rows = rows < available ? rows : available;
+  if (rows <= 0) { return; }
+
+  RRect sub = { 0, firstLine * MINIMAP_LINE_HEIGHT, map->columns, rows };
+  if (zoom == 1) {
+    RDrawImage(map->image, &sub, dst.x, dst.y, color);
+  } else {
+    RRect scaled = { dst.x, dst.y, map->columns * zoom, rows * zoom };
+    RDrawImageScaled(map->image, &sub, scaled, color, R_FILTER_NEAREST);
+  }
+}
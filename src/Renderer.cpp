@@ -2,38 +2,163 @@
 #include <cstdlib>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <assert.h>
 #include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "lib/stb/stb_truetype.h"
 #include "include/Renderer.hpp"
+#include "include/Arena.hpp"
+#include "include/Scheduler.hpp"
 
 
 /// Window
 static SDL_Window *window;
+/// physical pixels per logical pixel
+static float scale = 1;
+/// presented frames, used to age cached data
+static unsigned frame;
 
+/// rows are stride pixels apart, padded so every row starts 64 byte aligned
 struct RImage {
   RColor *pixels;
-  int width, height;
+  int width, height, stride;
+  RPixelFormat format;
+  bool swapped;  /* r and b trade places, BGRA in memory */
 };
 
+#define IMAGE_ROW_ALIGN (ARENA_ALIGN / sizeof(RColor))
+
 #define GLYPHSET_MAX 256
 #define INIT_IMAGE_WIDTH 128
 #define INIT_IMAGE_HEIGHT 128
 
+#define FONT_SCALES_MAX 4
+
 typedef struct {
   RImage *image;
   stbtt_bakedchar glyphs[GLYPHSET_MAX];
+  unsigned accesses;
+  unsigned lastUsed;  /* frame of the last lookup */
+  double bakeTime;    /* seconds */
 } GlyphSet;
 
+/// glyphs rasterized at one display scale, fonts keep a few of them
+/// so moving a window between monitors doesn't rebake everything
+typedef struct {
+  float scale;
+  int height;
+  GlyphSet *sets[GLYPHSET_MAX];
+} GlyphCache;
+
 struct RFont {
   void* data;
   stbtt_fontinfo stbfont;
   float size;
-  int height;
-  GlyphSet *sets[GLYPHSET_MAX];
+  float tabWidth;
+  RAntialiasing antialiasing;
+  GlyphCache caches[FONT_SCALES_MAX];
+  GlyphCache *cache;
+  int nextCache;
+  /* rasterization totals, freed sets included */
+  unsigned bakes;
+  double bakeTime;
 };
 
-static struct { int left, top, right, bottom; } clip;
+typedef struct { int left, top, right, bottom; } ClipRect;
+
+/// current clip and the ones saved by RPushClipRect
+static ClipRect clip;
+static ClipRect clipStack[R_CLIP_STACK_MAX];
+static int clipDepth;
+
+/// true when nothing of the rect survives the clip, checked before
+/// the surface lookup so fully clipped calls cost a few compares
+static inline bool clipRejects (int x, int y, int w, int h)
+{
+  return w <= 0 || h <= 0 ||
+    x >= clip.right || y >= clip.bottom || x + w <= clip.left || y + h <= clip.top;
+}
+
+static void purgeLines (RFont *font);
+
+#define LINEAR_BITS 12
+#define LINEAR_MAX ((1 << LINEAR_BITS) - 1)
+
+/// Text blending state, linear light blending goes through
+/// lookup tables so there is no pow() per pixel
+static struct {
+  bool linear;
+  uint16_t toLinear[256];
+  uint8_t fromLinear[LINEAR_MAX + 1];
+  uint8_t coverage[256];
+} textBlend;
+
+/// Byte order of the draw target. Colors handed to the kernels are swizzled
+/// to it once per call and images are converted to it once (RByteOrder),
+/// so blending never has to swizzle. Other formats are drawn to a shadow
+/// buffer converted on present
+enum { LAYOUT_RGBA, LAYOUT_BGRA, LAYOUT_OTHER };
+static int layout = LAYOUT_RGBA;
+static SDL_Surface *shadow;
+
+static uint32_t channelMask (int channel)
+{
+  uint8_t bytes[4] = { 0, 0, 0, 0 };
+  uint32_t mask;
+  bytes[channel] = 0xff;
+  memcpy(&mask, bytes, sizeof(mask));
+  return mask;
+}
+
+static int detectLayout (SDL_PixelFormat *f)
+{
+  if (f->BytesPerPixel != 4) { return LAYOUT_OTHER; }
+  bool alpha = f->Amask == 0 || f->Amask == channelMask(3);
+  if (alpha && f->Gmask == channelMask(1)) {
+    if (f->Rmask == channelMask(0) && f->Bmask == channelMask(2)) { return LAYOUT_RGBA; }
+    if (f->Rmask == channelMask(2) && f->Bmask == channelMask(0)) { return LAYOUT_BGRA; }
+  }
+  return LAYOUT_OTHER;
+}
+
+/// color in the byte order of the draw target, done once per call
+static inline RColor nativeColor (RColor color)
+{
+  if (layout == LAYOUT_BGRA) {
+    uint8_t r = color.r;
+    color.r = color.b;
+    color.b = r;
+  }
+  return color;
+}
+
+RColor RNativeColor (RColor color)
+{
+  return nativeColor(color);
+}
+
+static void swapRedBlue (RImage *image)
+{
+  for (int j = 0; j < image->height; j++) {
+    RColor *p = image->pixels + j * image->stride;
+    for (int i = 0; i < image->width; i++) {
+      uint8_t r = p[i].r;
+      p[i].r = p[i].b;
+      p[i].b = r;
+    }
+  }
+  image->swapped = !image->swapped;
+}
+
+/// converts the pixels of image to order in place
+static inline void setImageOrder (RImage *image, RByteOrder order)
+{
+  bool swapped = order == R_ORDER_NATIVE && layout == LAYOUT_BGRA;
+  if (image->swapped != swapped) { swapRedBlue(image); }
+}
 
 /// sets the window clip
 void RSetClipRect (RRect rect)
@@ -44,11 +169,46 @@ void RSetClipRect (RRect rect)
   clip.bottom = rect.y + rect.height;
 }
 
-void RInit(SDL_Window *win)
+/// saves the clip and intersects it with rect, nested views push and pop
+void RPushClipRect (RRect rect)
+{
+  assert(clipDepth < R_CLIP_STACK_MAX);
+  clipStack[clipDepth++] = clip;
+  int right = rect.x + rect.width;
+  int bottom = rect.y + rect.height;
+  clip.left   = rect.x > clip.left ? rect.x : clip.left;
+  clip.top    = rect.y > clip.top  ? rect.y : clip.top;
+  clip.right  = right < clip.right   ? right  : clip.right;
+  clip.bottom = bottom < clip.bottom ? bottom : clip.bottom;
+  /* keep empty intersections well formed */
+  clip.right  = clip.right  < clip.left ? clip.left : clip.right;
+  clip.bottom = clip.bottom < clip.top  ? clip.top  : clip.bottom;
+}
+
+void RPopClipRect (void)
+{
+  assert(clipDepth > 0);
+  clip = clipStack[--clipDepth];
+}
+
+/// rects pushed and not popped yet
+int RGetClipDepth (void)
+{
+  return clipDepth;
+}
+
+void RInit(SDL_Window *win, float scaleFactor)
 {
   assert(win);
   window = win;
+  RSetScale(scaleFactor);
   SDL_Surface *surf = SDL_GetWindowSurface(window);
+  int newLayout = detectLayout(surf->format);
+  /* cached lines are keyed by layout, the old ones would never be hit again */
+  if (newLayout != layout) { purgeLines(NULL); }
+  layout = newLayout;
+  /* clips pushed before a re-init belong to the old window */
+  clipDepth = 0;
   RSetClipRect( (RRect) {0, 0, surf->w, surf->h} );
 }
 
@@ -61,6 +221,60 @@ static void* checkAlloc (void *ptr)
   return ptr;
 }
 
+/// the surface the kernels draw to
+static SDL_Surface* getTarget (void)
+{
+  SDL_Surface *surf = SDL_GetWindowSurface(window);
+  if (layout != LAYOUT_OTHER) { return surf; }
+  if (!shadow || shadow->w != surf->w || shadow->h != surf->h) {
+    SDL_FreeSurface(shadow);
+    shadow = (SDL_Surface*) checkAlloc(
+      SDL_CreateRGBSurfaceWithFormat(0, surf->w, surf->h, 32, SDL_PIXELFORMAT_RGBA32));
+  }
+  return shadow;
+}
+
+/// copies a rect of the shadow buffer to the window surface, moving
+/// every channel to where the surface format wants it
+static void presentShadow (SDL_Surface *surf, RRect r)
+{
+  SDL_PixelFormat *f = surf->format;
+  RColor *src = (RColor*) shadow->pixels + r.x + r.y * shadow->w;
+  uint8_t *dst = (uint8_t*) surf->pixels + r.y * surf->pitch + r.x * f->BytesPerPixel;
+
+  if (f->BytesPerPixel != 4) {
+    SDL_ConvertPixels(r.width, r.height, SDL_PIXELFORMAT_RGBA32, src, shadow->pitch,
+      f->format, dst, surf->pitch);
+    return;
+  }
+
+  for (int j = 0; j < r.height; j++) {
+    RColor *s = src + j * shadow->w;
+    uint32_t *d = (uint32_t*) (dst + j * surf->pitch);
+    int i = 0;
+#if defined(__SSE2__) && SDL_BYTEORDER == SDL_LIL_ENDIAN
+    __m128i mask = _mm_set1_epi32(0xff);
+    __m128i rs = _mm_cvtsi32_si128(f->Rshift);
+    __m128i gs = _mm_cvtsi32_si128(f->Gshift);
+    __m128i bs = _mm_cvtsi32_si128(f->Bshift);
+    __m128i as = _mm_cvtsi32_si128(f->Ashift);
+    __m128i amask = _mm_set1_epi32(f->Amask ? 0xff : 0);
+    for (; i + 4 <= r.width; i += 4) {
+      __m128i v = _mm_loadu_si128((__m128i*) (s + i));
+      __m128i out = _mm_sll_epi32(_mm_and_si128(v, mask), rs);
+      out = _mm_or_si128(out, _mm_sll_epi32(_mm_and_si128(_mm_srli_epi32(v, 8), mask), gs));
+      out = _mm_or_si128(out, _mm_sll_epi32(_mm_and_si128(_mm_srli_epi32(v, 16), mask), bs));
+      out = _mm_or_si128(out, _mm_sll_epi32(_mm_and_si128(_mm_srli_epi32(v, 24), amask), as));
+      _mm_storeu_si128((__m128i*) (d + i), out);
+    }
+#endif
+    for (; i < r.width; i++) {
+      d[i] = ((uint32_t) s[i].r << f->Rshift) | ((uint32_t) s[i].g << f->Gshift) |
+             ((uint32_t) s[i].b << f->Bshift) | (f->Amask ? (uint32_t) s[i].a << f->Ashift : 0);
+    }
+  }
+}
+
 static const char* utf8ToCodepoint (const char *p, unsigned *dst)
 {
   unsigned res, n;
@@ -79,18 +293,205 @@ static const char* utf8ToCodepoint (const char *p, unsigned *dst)
 }
 
 
+static float srgbToLinear (float c)
+{
+  return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static float linearToSrgb (float c)
+{
+  return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+/// Sets how text is blended, linear blends glyphs in linear light.
+/// contrast [0, 1] sharpens glyph edges and darken [0, 1] thickens stems,
+/// both are baked in the coverage table.
+void RSetTextBlending (bool linear, float contrast, float darken)
+{
+  textBlend.linear = linear;
+  if (!linear) { return; }
+
+  for (int i = 0; i < 256; i++) {
+    textBlend.toLinear[i] = srgbToLinear(i / 255.0f) * LINEAR_MAX + 0.5f;
+  }
+  for (int i = 0; i <= LINEAR_MAX; i++) {
+    textBlend.fromLinear[i] = linearToSrgb(i / (float) LINEAR_MAX) * 255 + 0.5f;
+  }
+  for (int i = 0; i < 256; i++) {
+    float c = i / 255.0f;
+    c = powf(c, 1.0f / (1.0f + darken));
+    c += contrast * c * (1 - c) * (2 * c - 1);
+    c = c < 0 ? 0 : c > 1 ? 1 : c;
+    textBlend.coverage[i] = c * 255 + 0.5f;
+  }
+}
+
 /// gets surface size
-void RGetSize(int *x, int *y)
+void RGetSize(int *x, int *y, float *scaleFactor)
 {
   SDL_Surface *surf = SDL_GetWindowSurface(window);
   *x = surf->w;
   *y = surf->h;
+  if (scaleFactor) { *scaleFactor = scale; }
+}
+
+/// fonts pick the glyphs matching the new scale on their next use
+void RSetScale(float scaleFactor)
+{
+  assert(scaleFactor > 0);
+  scale = scaleFactor;
+}
+
+/// Present diffing, hashes of every DIFF_SPAN pixels of every row of the
+/// last presented frame, compared on present to find what really changed
+#define DIFF_SPAN 64
+
+static struct {
+  bool enabled, valid;
+  int width, height, spans;
+  uint64_t *hashes;
+  RRect *rects;
+  int rectsSize;
+} diff;
+
+void RSetPresentDiffing (bool enable)
+{
+  diff.enabled = enable;
+  diff.valid = false;
+}
+
+static uint64_t hashSpan (const uint32_t *p, int n)
+{
+  uint64_t h = 0x9E3779B185EBCA87ull;
+  int i = 0;
+#ifdef __SSE2__
+  /* multiply accumulate over 4 pixel stripes, the key moves every stripe
+     so swapped stripes don't hash the same */
+  __m128i acc = _mm_set_epi64x(0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull);
+  __m128i key = _mm_set_epi64x(0x27D4EB2F165667C5ull, 0x85EBCA77C2B2AE63ull);
+  const __m128i step = _mm_set_epi64x(0x9E3779B97F4A7C15ull, 0xBF58476D1CE4E5B9ull);
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+    __m128i k = _mm_xor_si128(v, key);
+    __m128i prod = _mm_mul_epu32(k, _mm_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1)));
+    acc = _mm_add_epi64(acc, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi64(acc, prod);
+    key = _mm_add_epi64(key, step);
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i*) lanes, acc);
+  h ^= lanes[0] * 0xFF51AFD7ED558CCDull;
+  h ^= (lanes[1] ^ (lanes[1] >> 29)) * 0xC4CEB9FE1A85EC53ull;
+#endif
+  for (; i < n; i++) {
+    h = (h ^ p[i]) * 0x100000001B3ull;
+  }
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDull;
+  h ^= h >> 33;
+  return h;
+}
+
+/// rehashes the spans touched by rects (all of them if count is 0) and
+/// returns the changed areas as a few rects
+static RRect* diffRects (SDL_Surface *target, RRect *rects, int *count)
+{
+  int spans = (target->w + DIFF_SPAN - 1) / DIFF_SPAN;
+  if (!diff.valid || diff.width != target->w || diff.height != target->h) {
+    diff.hashes = (uint64_t*) checkAlloc(
+      realloc(diff.hashes, (size_t) spans * target->h * sizeof(uint64_t)));
+    diff.width = target->w;
+    diff.height = target->h;
+    diff.spans = spans;
+    diff.valid = false;
+  }
+
+  /* rows and spans to look at */
+  int y1 = 0, y2 = target->h, s1 = 0, s2 = spans;
+  if (*count > 0 && diff.valid) {
+    y1 = target->h; y2 = 0; s1 = spans; s2 = 0;
+    for (int i = 0; i < *count; i++) {
+      RRect r = rects[i];
+      if (r.width <= 0 || r.height <= 0) { continue; }
+      y1 = r.y < y1 ? r.y : y1;
+      y2 = r.y + r.height > y2 ? r.y + r.height : y2;
+      s1 = r.x / DIFF_SPAN < s1 ? r.x / DIFF_SPAN : s1;
+      s2 = (r.x + r.width + DIFF_SPAN - 1) / DIFF_SPAN > s2 ? (r.x + r.width + DIFF_SPAN - 1) / DIFF_SPAN : s2;
+    }
+    y1 = y1 < 0 ? 0 : y1;
+    y2 = y2 > target->h ? target->h : y2;
+    s1 = s1 < 0 ? 0 : s1;
+    s2 = s2 > spans ? spans : s2;
+  }
+
+  int n = 0;
+  for (int y = y1; y < y2; y++) {
+    const uint32_t *row = (const uint32_t*) ((uint8_t*) target->pixels + y * target->pitch);
+    uint64_t *hashes = diff.hashes + y * spans;
+    int run = -1;
+    for (int sp = s1; sp <= s2; sp++) {
+      bool changed = false;
+      if (sp < s2) {
+        int x = sp * DIFF_SPAN;
+        int w = x + DIFF_SPAN > target->w ? target->w - x : DIFF_SPAN;
+        uint64_t h = hashSpan(row + x, w);
+        changed = !diff.valid || h != hashes[sp];
+        hashes[sp] = h;
+      }
+      if (changed && run < 0) { run = sp; }
+      if (changed || run < 0) { continue; }
+
+      /* a run of changed spans ended, extend the rect right above it or add one */
+      int x = run * DIFF_SPAN;
+      int w = (sp * DIFF_SPAN > target->w ? target->w : sp * DIFF_SPAN) - x;
+      run = -1;
+      bool extended = false;
+      for (int i = n - 1; i >= 0; i--) {
+        RRect *r = &diff.rects[i];
+        if (r->x == x && r->width == w && r->y + r->height == y) {
+          r->height++;
+          extended = true;
+          break;
+        }
+      }
+      if (extended) { continue; }
+      if (n == diff.rectsSize) {
+        diff.rectsSize = diff.rectsSize ? diff.rectsSize * 2 : 64;
+        diff.rects = (RRect*) checkAlloc(realloc(diff.rects, diff.rectsSize * sizeof(RRect)));
+      }
+      diff.rects[n++] = (RRect){ x, y, w, 1 };
+    }
+  }
+
+  diff.valid = true;
+  *count = n;
+  return diff.rects;
 }
 
 /// update all the rects in the window
+/// with present diffing on, rects only bound the area to compare
+/// (count 0 compares the whole frame)
 void RUpdateRects(RRect *rects, int count)
 {
-  SDL_UpdateWindowSurfaceRects(window, (SDL_Rect*) rects, count);
+  if (diff.enabled) {
+    rects = diffRects(getTarget(), rects, &count);
+  }
+  if (layout == LAYOUT_OTHER && shadow) {
+    SDL_Surface *surf = SDL_GetWindowSurface(window);
+    for (int i = 0; i < count; i++) {
+      RRect r = rects[i];
+      int x2 = r.x + r.width, y2 = r.y + r.height;
+      r.x = r.x < 0 ? 0 : r.x;
+      r.y = r.y < 0 ? 0 : r.y;
+      r.width  = (x2 > shadow->w ? shadow->w : x2) - r.x;
+      r.height = (y2 > shadow->h ? shadow->h : y2) - r.y;
+      if (r.width > 0 && r.height > 0) { presentShadow(surf, r); }
+    }
+  }
+  if (count > 0) {
+    SDL_UpdateWindowSurfaceRects(window, (SDL_Rect*) rects, count);
+  }
+  frame++;
   static bool initFrame = true;
   if (initFrame) {
     SDL_ShowWindow(window);
@@ -102,23 +503,170 @@ RImage* RNewImage (int w, int h)
 {
   /// win dims need to be positive
   assert(w > 0 && h > 0);
-  RImage *image = (RImage*) malloc (sizeof(RImage) + w * h * sizeof(RColor));
-  checkAlloc(image);
-  image->pixels = (RColor*) (image + 1);
+  RImage *image = (RImage*) ArenaAlloc(sizeof(RImage));
+  image->stride = (w + IMAGE_ROW_ALIGN - 1) & ~(IMAGE_ROW_ALIGN - 1);
+  image->pixels = (RColor*) ArenaAlloc(image->stride * h * sizeof(RColor));
   image->width = w;
   image->height = h;
+  image->format = R_PIXEL_STRAIGHT;
+  image->swapped = false;
   return image;
 }
 
 
 void RFreeImage(RImage *image)
 {
-  free (image);
+  ArenaFree(image->pixels, image->stride * image->height * sizeof(RColor));
+  ArenaFree(image, sizeof(RImage));
+}
+
+RColor* RGetImagePixels (RImage *image, int *stride, RByteOrder order)
+{
+  setImageOrder(image, order);
+  if (stride) { *stride = image->stride; }
+  return image->pixels;
+}
+
+/// x * y / 255, rounded
+static inline int mul255 (int x, int y)
+{
+  int t = x * y + 0x80;
+  return (t + (t >> 8)) >> 8;
+}
+
+/// x * 255 / a, rounded
+static inline uint8_t unpremultiply (int c, int a)
+{
+  return c >= a ? 0xff : (c * 0xff + a / 2) / a;
+}
+
+/// converts the image pixels in place, this is done once at creation
+/// so the drawing loops don't have to
+void RConvertImage (RImage *image, RPixelFormat format)
+{
+  if (image->format == format) { return; }
+  assert(image->format != R_PIXEL_SUBPIXEL && format != R_PIXEL_SUBPIXEL);
+  for (int j = 0; j < image->height; j++) {
+    RColor *p = image->pixels + j * image->stride;
+    for (int i = 0; i < image->width; i++, p++) {
+      if (format == R_PIXEL_PREMULTIPLIED) {
+        p->r = mul255(p->r, p->a);
+        p->g = mul255(p->g, p->a);
+        p->b = mul255(p->b, p->a);
+      } else if (p->a) {
+        /* channels above alpha aren't valid premultiplied data, they saturate */
+        p->r = unpremultiply(p->r, p->a);
+        p->g = unpremultiply(p->g, p->a);
+        p->b = unpremultiply(p->b, p->a);
+      }
+    }
+  }
+  image->format = format;
+}
+
+/// FIR filter applied across the subpixels, taps sum to 256
+#define LCD_FILTER_TAPS 5
+static const int lcdFilter[LCD_FILTER_TAPS] = { 8, 77, 86, 77, 8 };
+
+/// rasterizes the set at 3x horizontal resolution, filters it and stores
+/// one coverage per channel. returns false if the atlas is too small
+static bool bakeSubpixelGlyphs (RFont *font, int idx, RImage *image, stbtt_bakedchar *glyphs)
+{
+  float scale = stbtt_ScaleForMappingEmToPixels(&font->stbfont, font->size * font->cache->scale);
+  int x = 1, y = 1, bottom = 1;
+
+  memset(image->pixels, 0, image->stride * image->height * sizeof(RColor));
+
+  for (int i = 0; i < 256; i++) {
+    int codepoint = idx * 256 + i;
+    int advance, lsb, x0, y0, x1, y1;
+    stbtt_GetCodepointHMetrics(&font->stbfont, codepoint, &advance, &lsb);
+    stbtt_GetCodepointBitmapBoxSubpixel(&font->stbfont, codepoint,
+      scale * 3, scale, 0, 0, &x0, &y0, &x1, &y1);
+
+    /* shift the samples so pixel boundaries land on whole subpixel triplets */
+    int pad = LCD_FILTER_TAPS / 2;
+    int shift = ((x0 - pad) % 3 + 3) % 3;
+    int ow = x1 - x0, oh = y1 - y0;
+    int pw = ow > 0 ? (ow + 2 * pad + shift + 2) / 3 : 0;
+    if (oh <= 0) { oh = pw = 0; }
+
+    if (x + pw + 1 >= image->width) {
+      y = bottom;
+      x = 1;
+    }
+    /* wider than a row or out of rows, the atlas has to grow */
+    if (x + pw + 1 >= image->width || y + oh + 1 >= image->height) {
+      return false;
+    }
+
+    if (pw > 0) {
+      int stride = pw * 3;
+      unsigned char *samples = (unsigned char*) checkAlloc(calloc(stride, oh));
+      float subX, subY;
+      stbtt_MakeCodepointBitmapSubpixelPrefilter(&font->stbfont,
+        samples + pad + shift, ow, oh, stride,
+        scale * 3, scale, 0, 0, 1, 1, &subX, &subY, codepoint);
+
+      for (int j = 0; j < oh; j++) {
+        unsigned char *row = samples + j * stride;
+        RColor *d = image->pixels + x + (y + j) * image->stride;
+        for (int k = 0; k < pw; k++) {
+          int cov[3];
+          for (int c = 0; c < 3; c++) {
+            int sum = 0;
+            for (int t = 0; t < LCD_FILTER_TAPS; t++) {
+              int n = k * 3 + c + t - pad;
+              if (n >= 0 && n < stride) { sum += lcdFilter[t] * row[n]; }
+            }
+            cov[c] = sum >> 8;
+          }
+          int a = cov[0] > cov[1] ? cov[0] : cov[1];
+          a = a > cov[2] ? a : cov[2];
+          d[k] = (RColor){ .r = (uint8_t) cov[0], .g = (uint8_t) cov[1], .b = (uint8_t) cov[2], .a = (uint8_t) a };
+        }
+      }
+      free(samples);
+    }
+
+    stbtt_bakedchar *g = &glyphs[i];
+    g->x0 = x;
+    g->y0 = y;
+    g->x1 = x + pw;
+    g->y1 = y + oh;
+    g->xoff = (x0 - pad - shift) / 3;
+    g->yoff = y0;
+    g->xadvance = scale * advance;
+
+    x += pw + 1;
+    if (y + oh + 1 > bottom) { bottom = y + oh + 1; }
+  }
+
+  image->format = R_PIXEL_SUBPIXEL;
+  return true;
+}
+
+/// widest glyph of the set baked at pixel height size, and the area its
+/// glyphs cover with the packers' 1 pixel gaps
+static int measureGlyphs (RFont *font, int idx, float size, size_t *area)
+{
+  float scale = stbtt_ScaleForPixelHeight(&font->stbfont, size);
+  int widest = 0;
+  *area = 0;
+  for (int i = 0; i < 256; i++) {
+    int x0, y0, x1, y1;
+    stbtt_GetCodepointBitmapBox(&font->stbfont, idx * 256 + i, scale, scale, &x0, &y0, &x1, &y1);
+    if (x1 - x0 > widest) { widest = x1 - x0; }
+    if (x1 > x0 && y1 > y0) { *area += (size_t) (x1 - x0 + 1) * (y1 - y0 + 1); }
+  }
+  return widest;
 }
 
 static GlyphSet* loadGlyphset(RFont* font, int idx)
 {
-  GlyphSet *set = (GlyphSet*) checkAlloc(calloc(1, sizeof(GlyphSet)));
+  Uint64 start = SDL_GetPerformanceCounter();
+  GlyphSet *set = (GlyphSet*) ArenaAlloc(sizeof(GlyphSet));
+  memset(set, 0, sizeof(GlyphSet));
 
   // image init
   int width  = INIT_IMAGE_WIDTH;
@@ -126,35 +674,78 @@ static GlyphSet* loadGlyphset(RFont* font, int idx)
 
   bool validBufferSize = false;
 
+  // basically doing this "pixels / (ascent - descent)" but fancy :).
+  float s = 
+    stbtt_ScaleForMappingEmToPixels(&font->stbfont, 1) /
+    stbtt_ScaleForPixelHeight(&font->stbfont, 1);
+  float pixelHeight = font->size * font->cache->scale * s;
+
+  /* start at the first atlas that can hold the glyphs' area, every
+     smaller attempt would be baked and thrown away. Each doubling is a
+     new arena class, a failed atlas is only reused by a later set */
+  size_t area;
+  int widest = measureGlyphs(font, idx, pixelHeight, &area);
+  while ((size_t) width * height < area) {
+    width *= 2;
+    height *= 2;
+  }
+  /* stb's packer only checks the height, a glyph wider than a row
+     would be written past it */
+  if (font->antialiasing == R_AA_GRAYSCALE) {
+    while (widest + 2 >= width) {
+      width *= 2;
+      height *= 2;
+    }
+  }
 
   while (!validBufferSize)
   {
 
     set->image = RNewImage(width, height);
 
-    // basically doing this "pixels / (ascent - descent)" but fancy :).
-    float s = 
-      stbtt_ScaleForMappingEmToPixels(&font->stbfont, 1) /
-      stbtt_ScaleForPixelHeight(&font->stbfont, 1);
+    if (font->antialiasing == R_AA_SUBPIXEL) {
+      validBufferSize = bakeSubpixelGlyphs(font, idx, set->image, set->glyphs);
+      if (!validBufferSize) {
+        width *= 2;
+        height *= 2;
+        RFreeImage(set->image);
+      }
+      continue;
+    }
 
-    int res = stbtt_BakeFontBitmap((const unsigned char*) font->data, 0, font->size * s, 
+    int res = stbtt_BakeFontBitmap((const unsigned char*) font->data, 0, pixelHeight,
       (unsigned char*) set->image->pixels,
       width, height, idx * 256, 256, set->glyphs);
 
     // if size is not enough DOUBLE ITTTT.
-    if (res < 0) {
-      width *= 2;
+    // (0 is the first glyph not fitting, -i the i-th one)
+    if (res <= 0) {
       width *= 2;
+      height *= 2;
       RFreeImage(set->image);
       continue;
     }
     validBufferSize = true;
+
+    /* convert 8bit data to 32bit (premultiplied white), backwards so the
+       8bit rows aren't overwritten before being read */
+    int stride = set->image->stride;
+    for (int j = height - 1; j >= 0; j--) {
+      for (int i = width - 1; i >= 0; i--) {
+        /* cast to uint8_t ptr and then offset it */
+        uint8_t n = *((uint8_t*) set->image->pixels + i + j * width);
+        set->image->pixels[i + j * stride] = (RColor){ .r = n, .g = n, .b = n, .a = n};
+      }
+    }
+    set->image->format = R_PIXEL_PREMULTIPLIED;
+    /* gray, the same in either order */
+    set->image->swapped = layout == LAYOUT_BGRA;
   }
 
   int asc, desc, linegap;
   stbtt_GetFontVMetrics(&font->stbfont, &asc, &desc, &linegap);
 
-  float scale = stbtt_ScaleForMappingEmToPixels(&font->stbfont, font->size);
+  float scale = stbtt_ScaleForMappingEmToPixels(&font->stbfont, font->size * font->cache->scale);
   int scaledAsc = asc * scale * 0.5;
 
   for (int i = 0; i < 256; i++) {
@@ -164,26 +755,194 @@ static GlyphSet* loadGlyphset(RFont* font, int idx)
     set->glyphs[i].xadvance = floor(set->glyphs[i].xadvance);
   }
 
-  /* convert 8bit data to 32bit */
-  for (int i = width * height - 1; i >= 0; i--) {
-    /* cast to uint8_t ptr and then offset it by i */
-    uint8_t n = *((uint8_t*) set->image->pixels + i);
-    set->image->pixels[i] = (RColor){ .r = 255, .g = 255, .b = 255, .a = n};
+  /// make tab and newline glyphs invisible, every time set 0 is baked
+  if (idx == 0) {
+    stbtt_bakedchar *g = set->glyphs;
+    g['\t'].x1 = g['\t'].x0;
+    g['\n'].x1 = g['\n'].x0;
+    if (font->tabWidth > 0) {
+      g['\t'].xadvance = floor(font->tabWidth * font->cache->scale + 0.5);
+    }
   }
 
+  set->lastUsed = frame;
+  set->bakeTime = (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+  font->bakes++;
+  font->bakeTime += set->bakeTime;
   return set;
 }
 
+static size_t glyphsetBytes (GlyphSet *set)
+{
+  return sizeof(GlyphSet) + set->image->stride * set->image->height * sizeof(RColor);
+}
+
+static void freeGlyphset (GlyphCache *cache, int idx)
+{
+  GlyphSet *set = cache->sets[idx];
+  if (set) {
+    RFreeImage(set->image);
+    ArenaFree(set, sizeof(GlyphSet));
+    cache->sets[idx] = NULL;
+  }
+}
+
+static void freeGlyphCache(GlyphCache *cache)
+{
+  for (int i = 0; i < GLYPHSET_MAX; i++) {
+    freeGlyphset(cache, i);
+  }
+  cache->scale = 0;
+}
+
+static void freeGlyphCaches(RFont *font)
+{
+  for (int i = 0; i < FONT_SCALES_MAX; i++) {
+    freeGlyphCache(&font->caches[i]);
+  }
+  font->cache = NULL;
+}
+
+/// gets the glyph cache for the current scale, creating (or recycling) one if needed
+static bool prefetchTask (void *udata, double deadline);
+
+static GlyphCache* getGlyphCache (RFont *font)
+{
+  if (font->cache && font->cache->scale == scale) {
+    return font->cache;
+  }
+
+  for (int i = 0; i < FONT_SCALES_MAX; i++) {
+    if (font->caches[i].scale == scale) {
+      font->cache = &font->caches[i];
+      return font->cache;
+    }
+  }
+
+  GlyphCache *cache = &font->caches[font->nextCache];
+  font->nextCache = (font->nextCache + 1) % FONT_SCALES_MAX;
+  freeGlyphCache(cache);
+  cache->scale = scale;
+  font->cache = cache;
+
+  /// get height at this scale
+  int ascent, descent, linegap;
+  stbtt_GetFontVMetrics(&font->stbfont, &ascent, &descent, &linegap);
+  float s = stbtt_ScaleForMappingEmToPixels(&font->stbfont, font->size * scale);
+  cache->height = (ascent - descent + linegap) * s + 0.5;
+  cache->sets[0] = loadGlyphset(font, 0);
+  /* the sets drawn at the previous scale are likely next */
+  SchedAdd(SCHED_GLYPH_PREFETCH, prefetchTask, font);
+
+  return cache;
+}
+
+/// bakes the sets the font has at other scales into the current cache,
+/// a scale change then doesn't stall the frames that follow it
+static bool prefetchTask (void *udata, double deadline)
+{
+  RFont *font = (RFont*) udata;
+  GlyphCache *cache = font->cache;
+  /* the caches were dropped meanwhile (antialiasing switch) */
+  if (!cache) { return false; }
+  for (int idx = 1; idx < GLYPHSET_MAX; idx++) {
+    if (cache->sets[idx]) { continue; }
+    for (int i = 0; i < FONT_SCALES_MAX; i++) {
+      GlyphCache *other = &font->caches[i];
+      if (other == cache || !other->sets[idx]) { continue; }
+      if (SchedTime() >= deadline) { return true; }
+      /* baked directly, prefetched sets don't count as used */
+      cache->sets[idx] = loadGlyphset(font, idx);
+      break;
+    }
+  }
+  return false;
+}
+
 static GlyphSet* getGlyphset (RFont *font, int codepoint)
 {
+  GlyphCache *cache = getGlyphCache(font);
   int idx = (codepoint >> 8) % GLYPHSET_MAX;
-  if (!font->sets[idx]) {
-    font->sets[idx] = loadGlyphset(font, idx);
+  if (!cache->sets[idx]) {
+    cache->sets[idx] = loadGlyphset(font, idx);
+  }
+  GlyphSet *set = cache->sets[idx];
+  set->accesses++;
+  set->lastUsed = frame;
+  return set;
+}
+
+int RGetFontStats (RFont *font, RFontStats *stats, RGlyphSetStats *sets, int max)
+{
+  memset(stats, 0, sizeof(*stats));
+  stats->bakes = font->bakes;
+  stats->bakeTime = font->bakeTime;
+  stats->frame = frame;
+
+  for (int c = 0; c < FONT_SCALES_MAX; c++) {
+    GlyphCache *cache = &font->caches[c];
+    if (cache->scale == 0) { continue; }
+    for (int i = 0; i < GLYPHSET_MAX; i++) {
+      GlyphSet *set = cache->sets[i];
+      if (!set) { continue; }
+      if (stats->sets < max) {
+        RGlyphSetStats *s = &sets[stats->sets];
+        s->firstCodepoint = i * 256;
+        s->scale = cache->scale;
+        s->width = set->image->width;
+        s->height = set->image->height;
+        s->bytes = glyphsetBytes(set);
+        s->accesses = set->accesses;
+        s->lastUsed = set->lastUsed;
+        s->bakeTime = set->bakeTime;
+      }
+      stats->sets++;
+      stats->bytes += glyphsetBytes(set);
+    }
+  }
+  return stats->sets < max ? stats->sets : max;
+}
+
+/// Set 0 of the current display scale is kept, nearly every line needs it.
+/// Caches of other scales go away as a whole
+/// once all their sets are cold. Cached lines hold their own pixels and
+/// don't need the sets they were drawn from. The freed atlases are given
+/// back to the system rather than kept in the arena.
+size_t RTrimFont (RFont *font, unsigned age)
+{
+  size_t released = 0;
+  for (int c = 0; c < FONT_SCALES_MAX; c++) {
+    GlyphCache *cache = &font->caches[c];
+    if (cache->scale == 0) { continue; }
+
+    bool current = cache->scale == scale;
+    bool allCold = true;
+    for (int i = 0; i < GLYPHSET_MAX; i++) {
+      GlyphSet *set = cache->sets[i];
+      if (set && frame - set->lastUsed < age) { allCold = false; }
+    }
+    if (!current && allCold) {
+      for (int i = 0; i < GLYPHSET_MAX; i++) {
+        if (cache->sets[i]) { released += glyphsetBytes(cache->sets[i]); }
+      }
+      freeGlyphCache(cache);
+      if (font->cache == cache) { font->cache = NULL; }
+      continue;
+    }
+
+    for (int i = 0; i < GLYPHSET_MAX; i++) {
+      GlyphSet *set = cache->sets[i];
+      if (!set || (i == 0 && current) || frame - set->lastUsed < age) { continue; }
+      released += glyphsetBytes(set);
+      freeGlyphset(cache, i);
+    }
   }
-  return font->sets[idx];
+  ArenaTrim();
+  return released;
 }
 
 
+/// size is in logical pixels, glyphs are rasterized at size * scale
 RFont* RLoadFont (const char *filename, float size)
 {
   RFont *font = NULL;
@@ -193,7 +952,7 @@ RFont* RLoadFont (const char *filename, float size)
   font->size = size;
 
   fp = fopen(filename, "rb");
-  if (!fp) { return NULL; }
+  if (!fp) { free(font); return NULL; }
 
   fseek(fp, 0, SEEK_END);
   int buffSize = ftell(fp);
@@ -214,38 +973,42 @@ RFont* RLoadFont (const char *filename, float size)
     free (font);
     return NULL;
   } else {
-    /// get height and scale
-    int ascent, descent, linegap;
-    stbtt_GetFontVMetrics(&font->stbfont, &ascent, &descent, &linegap);
-    float scale = stbtt_ScaleForMappingEmToPixels(&font->stbfont, size);
-    font->height = (ascent - descent + linegap) * scale + 0.5;
-    
-    /// make tab and newline glyphs invisible
-    stbtt_bakedchar *g = getGlyphset(font, '\n')->glyphs;
-    g['\t'].x1 = g['\t'].x0;
-    g['\n'].x1 = g['\n'].x0;
-
+    getGlyphCache(font);
     return font;
   }
 }
 
 void RFreeFont(RFont *font)
 {
-  for (int i = 0; i < GLYPHSET_MAX; i++) {
-    GlyphSet *set = font->sets[i];
-    if (set) {
-      RFreeImage(set->image);
-      free (set);
-    }
-    free (font->data);
-    free (font);
-  }
+  SchedRemove(prefetchTask, font);
+  purgeLines(font);
+  freeGlyphCaches(font);
+  free (font->data);
+  free (font);
+}
+
+/// switching mode drops the cached glyphs, they are baked again on demand
+void RSetFontAntialiasing(RFont *font, RAntialiasing mode)
+{
+  if (font->antialiasing == mode) { return; }
+  purgeLines(font);
+  freeGlyphCaches(font);
+  font->antialiasing = mode;
 }
 
+/// w is in physical pixels at the current scale, the caches of other
+/// scales get the same width in logical pixels
 void RSetFontTabWidth(RFont *font, int w)
 {
-  GlyphSet *set = getGlyphset(font, '\t');
-  set->glyphs['\t'].xadvance = w;
+  GlyphCache *current = getGlyphCache(font);
+  font->tabWidth = w / scale;
+  for (int i = 0; i < FONT_SCALES_MAX; i++) {
+    GlyphCache *cache = &font->caches[i];
+    if (cache->scale == 0 || !cache->sets[0]) { continue; }
+    cache->sets[0]->glyphs['\t'].xadvance =
+      cache == current ? w : floor(font->tabWidth * cache->scale + 0.5);
+  }
+  purgeLines(font);
 }
 
 int RGetFontTabWidth(RFont *font)
@@ -256,7 +1019,7 @@ int RGetFontTabWidth(RFont *font)
 
 int RGetFontHeigh(RFont *font)
 {
-  return font->height;
+  return getGlyphCache(font)->height;
 }
 
 int RGetFontWidth(RFont *font, const char *text)
@@ -273,17 +1036,6 @@ int RGetFontWidth(RFont *font, const char *text)
   return x;
 }
 
-/// Blending color
-static inline RColor blendPixel (RColor dst, RColor src)
-{
-  int ia = 0xff - src.a; // How much of dst should we retain
-  dst.r = ((src.r * src.a) + (dst.r * ia)) >> 8;
-  dst.g = ((src.g * src.a) + (dst.g * ia)) >> 8;
-  dst.b = ((src.b * src.a) + (dst.b * ia)) >> 8;
-  return dst;
-}
-
-
 static inline RColor blendPixel2(RColor dst, RColor src, RColor color)
 {
   src.a = (src.a * color.a) >> 8;
@@ -294,6 +1046,109 @@ static inline RColor blendPixel2(RColor dst, RColor src, RColor color)
   return dst;
 }
 
+/// Blending a premultiplied source, one multiply-add per channel
+static inline RColor blendPixelPremul (RColor dst, RColor src)
+{
+  int ia = 0xff - src.a;
+  dst.r = src.r + mul255(dst.r, ia);
+  dst.g = src.g + mul255(dst.g, ia);
+  dst.b = src.b + mul255(dst.b, ia);
+  dst.a = src.a + mul255(dst.a, ia);
+  return dst;
+}
+
+/// Same as above but tinted by a premultiplied color
+static inline RColor blendPixelPremul2 (RColor dst, RColor src, RColor pcolor)
+{
+  int a = mul255(src.a, pcolor.a);
+  int ia = 0xff - a;
+  dst.r = mul255(src.r, pcolor.r) + mul255(dst.r, ia);
+  dst.g = mul255(src.g, pcolor.g) + mul255(dst.g, ia);
+  dst.b = mul255(src.b, pcolor.b) + mul255(dst.b, ia);
+  dst.a = a + mul255(dst.a, ia);
+  return dst;
+}
+
+static inline RColor premultiplyColor (RColor color)
+{
+  color.r = mul255(color.r, color.a);
+  color.g = mul255(color.g, color.a);
+  color.b = mul255(color.b, color.a);
+  return color;
+}
+
+/// x / 255 for x up to 255 * LINEAR_MAX
+static inline int div255 (int x)
+{
+  return (x * 257 + 0x8080) >> 16;
+}
+
+/// Blending a glyph coverage in linear light
+static inline RColor blendPixelLinear (RColor dst, RColor src, const uint16_t *lcolor, int ca)
+{
+  int a = mul255(textBlend.coverage[src.a], ca);
+  int ia = 0xff - a;
+  const uint16_t *tl = textBlend.toLinear;
+  const uint8_t *fl = textBlend.fromLinear;
+  dst.r = fl[div255(lcolor[0] * a + tl[dst.r] * ia)];
+  dst.g = fl[div255(lcolor[1] * a + tl[dst.g] * ia)];
+  dst.b = fl[div255(lcolor[2] * a + tl[dst.b] * ia)];
+  return dst;
+}
+
+/// Blending one coverage per channel (LCD glyphs)
+static inline RColor blendPixelSubpixel (RColor dst, RColor src, RColor color)
+{
+  int ar = mul255(src.r, color.a);
+  int ag = mul255(src.g, color.a);
+  int ab = mul255(src.b, color.a);
+  dst.r = mul255(color.r, ar) + mul255(dst.r, 0xff - ar);
+  dst.g = mul255(color.g, ag) + mul255(dst.g, 0xff - ag);
+  dst.b = mul255(color.b, ab) + mul255(dst.b, 0xff - ab);
+  return dst;
+}
+
+static inline RColor blendPixelSubpixelLinear (RColor dst, RColor src, const uint16_t *lcolor, int ca)
+{
+  const uint8_t *cov = textBlend.coverage;
+  const uint16_t *tl = textBlend.toLinear;
+  const uint8_t *fl = textBlend.fromLinear;
+  int ar = mul255(cov[src.r], ca);
+  int ag = mul255(cov[src.g], ca);
+  int ab = mul255(cov[src.b], ca);
+  dst.r = fl[div255(lcolor[0] * ar + tl[dst.r] * (0xff - ar))];
+  dst.g = fl[div255(lcolor[1] * ag + tl[dst.g] * (0xff - ag))];
+  dst.b = fl[div255(lcolor[2] * ab + tl[dst.b] * (0xff - ab))];
+  return dst;
+}
+
+static inline uint32_t pixelBits (RColor c)
+{
+  uint32_t v;
+  memcpy(&v, &c, sizeof(v));
+  return v;
+}
+
+#ifdef __SSE2__
+/// blendPixelPremul on 4 pixels at once
+static inline __m128i blend4Premul (__m128i dst, __m128i src)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i a = _mm_srli_epi32(src, 24);
+  a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+  a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+  __m128i ia = _mm_xor_si128(a, _mm_set1_epi8(-1));
+  __m128i round = _mm_set1_epi16(0x80);
+
+  __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), _mm_unpacklo_epi8(ia, zero)), round);
+  __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), _mm_unpackhi_epi8(ia, zero)), round);
+  lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+  hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+  return _mm_add_epi8(src, _mm_packus_epi16(lo, hi));
+}
+#endif
+
 /// Drawing loops
 
 
@@ -306,33 +1161,76 @@ static inline RColor blendPixel2(RColor dst, RColor src, RColor color)
     d += dr;                        \
   }
 
-void RDrawRect (RRect rect, RColor color)
-{
-  if (color.a == 0) { return; }
+#define imageDrawLoop(expr)                \
+  for (int j = 0; j < sub->height; j++) {  \
+    for (int i = 0; i < sub->width; i++) { \
+      *d = expr;                           \
+      d++;                                 \
+      s++;                                 \
+    }                                      \
+    d += dr;                               \
+    s += sr;                               \
+  }
 
+/// fills rect clipped, color is already in the target byte order
+static void fillRect (SDL_Surface *surf, RRect rect, RColor color)
+{
   int x1 = rect.x < clip.left ? clip.left : rect.x;
   int y1 = rect.y < clip.top  ? clip.top  : rect.y;
   int x2 = rect.x + rect.width;
   int y2 = rect.y + rect.height;
   x2 = x2 > clip.right  ? clip.right  : x2;
   y2 = y2 > clip.bottom ? clip.bottom : y2;
+  if (x1 >= x2 || y1 >= y2) { return; }
 
-  SDL_Surface *surf = SDL_GetWindowSurface(window);
   RColor *d = (RColor*) surf->pixels;
   d += x1 + y1 * surf->w;
-  int dr = surf->w - (x2 - x1);
 
+#ifdef __SSE2__
+  int w = x2 - x1;
+  if (color.a == 0xff) {
+    __m128i c = _mm_set1_epi32(pixelBits(color));
+    for (int j = y1; j < y2; j++) {
+      int i = 0;
+      for (; i + 4 <= w; i += 4) { _mm_storeu_si128((__m128i*) (d + i), c); }
+      for (; i < w; i++) { d[i] = color; }
+      d += surf->w;
+    }
+  } else {
+    RColor pcolor = premultiplyColor(color);
+    __m128i pc = _mm_set1_epi32(pixelBits(pcolor));
+    for (int j = y1; j < y2; j++) {
+      int i = 0;
+      for (; i + 4 <= w; i += 4) {
+        __m128i dst = _mm_loadu_si128((__m128i*) (d + i));
+        _mm_storeu_si128((__m128i*) (d + i), blend4Premul(dst, pc));
+      }
+      for (; i < w; i++) { d[i] = blendPixelPremul(d[i], pcolor); }
+      d += surf->w;
+    }
+  }
+#else
+  int dr = surf->w - (x2 - x1);
   if (color.a == 0xff) {
     rectDrawLoop (color);
   } else {
-    rectDrawLoop (blendPixel(*d, color));
+    RColor pcolor = premultiplyColor(color);
+    rectDrawLoop (blendPixelPremul(*d, pcolor));
   }
+#endif
 }
 
+void RDrawRect (RRect rect, RColor color)
+{
+  if (color.a == 0 || clipRejects(rect.x, rect.y, rect.width, rect.height)) { return; }
+  fillRect(getTarget(), rect, nativeColor(color));
+}
 
-void RDrawImage (RImage *image, RRect *sub, int x, int y, RColor color)
+
+static void drawImage (SDL_Surface *surf, RImage *image, RRect *sub, int x, int y, RColor color, bool text)
 {
   if (color.a == 0) { return; }
+  setImageOrder(image, R_ORDER_NATIVE);
 
   int n;
   if ((n = clip.left - x) > 0) { sub->width  -= n; sub->x += n; x += n; }
@@ -344,22 +1242,612 @@ void RDrawImage (RImage *image, RRect *sub, int x, int y, RColor color)
     return;
   }
 
-  SDL_Surface *surf = SDL_GetWindowSurface(window);
   RColor *s = image->pixels;
   RColor *d = (RColor*) surf->pixels;
-  s += sub->x + sub->y * image->width;
+  s += sub->x + sub->y * image->stride;
   d += x + y * surf->w;
-  int sr = image->width - sub->width;
+  int sr = image->stride - sub->width;
   int dr = surf->w - sub->width;
+  color = nativeColor(color);
+
+  uint16_t lcolor[3] = {
+    textBlend.toLinear[color.r],
+    textBlend.toLinear[color.g],
+    textBlend.toLinear[color.b]
+  };
+
+  if (image->format == R_PIXEL_SUBPIXEL) {
+    if (textBlend.linear) {
+      imageDrawLoop (blendPixelSubpixelLinear(*d, *s, lcolor, color.a));
+    } else {
+      imageDrawLoop (blendPixelSubpixel(*d, *s, color));
+    }
+  } else if (text && textBlend.linear && image->format == R_PIXEL_PREMULTIPLIED) {
+    imageDrawLoop (blendPixelLinear(*d, *s, lcolor, color.a));
+  } else if (image->format == R_PIXEL_PREMULTIPLIED) {
+    bool opaqueWhite =
+      color.r == 0xff && color.g == 0xff && color.b == 0xff && color.a == 0xff;
+    RColor pcolor = premultiplyColor(color);
+    if (opaqueWhite) {
+#ifdef __SSE2__
+      /* cached strips are mostly empty, skip fully transparent quads */
+      __m128i zero = _mm_setzero_si128();
+      for (int j = 0; j < sub->height; j++) {
+        int i = 0;
+        for (; i + 4 <= sub->width; i += 4) {
+          __m128i src = _mm_loadu_si128((__m128i*) (s + i));
+          if (_mm_movemask_epi8(_mm_cmpeq_epi32(src, zero)) == 0xffff) { continue; }
+          __m128i dst = _mm_loadu_si128((__m128i*) (d + i));
+          _mm_storeu_si128((__m128i*) (d + i), blend4Premul(dst, src));
+        }
+        for (; i < sub->width; i++) { d[i] = blendPixelPremul(d[i], s[i]); }
+        d += surf->w;
+        s += image->stride;
+      }
+#else
+      imageDrawLoop (blendPixelPremul(*d, *s));
+#endif
+    } else {
+      imageDrawLoop (blendPixelPremul2(*d, *s, pcolor));
+    }
+  } else {
+    imageDrawLoop (blendPixel2(*d, *s, color));
+  }
+}
+
+void RDrawImage (RImage *image, RRect *sub, int x, int y, RColor color)
+{
+  if (clipRejects(x, y, sub->width, sub->height)) { return; }
+  drawImage(getTarget(), image, sub, x, y, color, false);
+}
+
+/// draws count rects resolving the target once, in submission order
+/// like the same RDrawRect calls would
+void RDrawRects (const RRectCmd *cmds, int count)
+{
+  if (count <= 0) { return; }
+  SDL_Surface *surf = getTarget();
+  for (int i = 0; i < count; i++) {
+    const RRectCmd *c = &cmds[i];
+    if (c->color.a == 0 || clipRejects(c->rect.x, c->rect.y, c->rect.width, c->rect.height)) { continue; }
+    fillRect(surf, c->rect, nativeColor(c->color));
+  }
+}
+
+/// draws count sub images of one image (glyph quads, icons) tinted by color
+void RDrawImageBatch (RImage *image, const RImageCmd *cmds, int count, RColor color)
+{
+  if (count <= 0 || color.a == 0) { return; }
+  SDL_Surface *surf = getTarget();
+  for (int i = 0; i < count; i++) {
+    const RImageCmd *c = &cmds[i];
+    RRect sub = c->sub;
+    if (clipRejects(c->x, c->y, sub.width, sub.height)) { continue; }
+    drawImage(surf, image, &sub, c->x, c->y, color, false);
+  }
+}
+
+
+/// Rendered line cache, whole lines are composited once into a strip
+/// and drawn again with a single blit while they stay unchanged
+#define LINE_CACHE_BUCKETS 1024
+#define LINE_CACHE_BUDGET (16 * 1024 * 1024)
+
+typedef struct LineEntry {
+  struct LineEntry *next;
+  struct LineEntry *older, *newer;  /* LRU order */
+  uint64_t hash;
+  RFont *font;
+  char *text;
+  RImage *image;
+  int x, y;          /* strip origin relative to the pen */
+  bool baked;        /* the color is baked in the strip */
+  size_t bytes;
+} LineEntry;
 
-  for (int j = 0; j < sub->height; j++) {
-    for (int i = 0; i < sub->width; i++) {
-      *d = blendPixel2(*d, *s, color);
-      d++;
-      s++;
+static struct {
+  LineEntry *buckets[LINE_CACHE_BUCKETS];
+  LineEntry *oldest, *newest;
+  size_t bytes;
+} lineCache;
+
+static size_t lineCacheBudget = LINE_CACHE_BUDGET;
+
+static uint64_t hashLine (RFont *font, const char *text, RColor color)
+{
+  uint64_t h = 14695981039346656037ull;
+  for (const char *p = text; *p; p++) {
+    h = (h ^ (uint8_t) *p) * 1099511628211ull;
+  }
+  uint32_t scaleBits;
+  memcpy(&scaleBits, &scale, sizeof(scaleBits));
+  /* read directly, a lookup through getGlyphset would count as a use of set 0 */
+  int tabWidth = getGlyphCache(font)->sets[0]->glyphs['\t'].xadvance;
+  uint64_t extra[] = {
+    (uint64_t) (uintptr_t) font, pixelBits(color), (uint64_t) tabWidth,
+    scaleBits, (uint64_t) textBlend.linear, (uint64_t) layout
+  };
+  for (uint64_t e : extra) {
+    h = (h ^ e) * 1099511628211ull;
+  }
+  return h;
+}
+
+static void unlinkLru (LineEntry *e)
+{
+  if (e->older) { e->older->newer = e->newer; } else { lineCache.oldest = e->newer; }
+  if (e->newer) { e->newer->older = e->older; } else { lineCache.newest = e->older; }
+  e->older = e->newer = NULL;
+}
+
+static void pushLru (LineEntry *e)
+{
+  e->older = lineCache.newest;
+  e->newer = NULL;
+  if (lineCache.newest) { lineCache.newest->newer = e; } else { lineCache.oldest = e; }
+  lineCache.newest = e;
+}
+
+static void freeLine (LineEntry **link)
+{
+  LineEntry *e = *link;
+  *link = e->next;
+  unlinkLru(e);
+  lineCache.bytes -= e->bytes;
+  if (e->image) { RFreeImage(e->image); }
+  free(e->text);
+  free(e);
+}
+
+/// drops every cached line of font, or all of them if font is NULL
+static void purgeLines (RFont *font)
+{
+  for (int i = 0; i < LINE_CACHE_BUCKETS; i++) {
+    LineEntry **link = &lineCache.buckets[i];
+    while (*link) {
+      if (!font || (*link)->font == font) {
+        freeLine(link);
+      } else {
+        link = &(*link)->next;
+      }
     }
-    d += dr;
-    s += sr;
   }
+}
 
-}
\ No newline at end of file
+/// evicts the least recently drawn lines until the cache fits in budget
+static void trimLines (size_t budget)
+{
+  while (lineCache.bytes > budget) {
+    LineEntry *e = lineCache.oldest;
+    LineEntry **link = &lineCache.buckets[e->hash % LINE_CACHE_BUCKETS];
+    while (*link != e) { link = &(*link)->next; }
+    freeLine(link);
+  }
+}
+
+/// 0 disables the cache
+void RSetLineCacheBudget (size_t bytes)
+{
+  lineCacheBudget = bytes;
+  trimLines(bytes);
+}
+
+/// composites the glyphs of text into a strip, false when the strip
+/// alone wouldn't fit in the cache budget
+static bool renderLine (LineEntry *e, RFont *font, const char *text, RColor color)
+{
+  int minX = 0, minY = 0, maxX = 0, maxY = 0;
+  bool empty = true;
+  int x = 0;
+  const char *p = text;
+  unsigned codepoint;
+  while (*p) {
+    p = utf8ToCodepoint(p, &codepoint);
+    stbtt_bakedchar *g = &getGlyphset(font, codepoint)->glyphs[codepoint & 0xff];
+    int gx = x + g->xoff, gy = g->yoff;
+    int gw = g->x1 - g->x0, gh = g->y1 - g->y0;
+    if (gw > 0 && gh > 0) {
+      if (empty || gx < minX) { minX = gx; }
+      if (empty || gy < minY) { minY = gy; }
+      if (empty || gx + gw > maxX) { maxX = gx + gw; }
+      if (empty || gy + gh > maxY) { maxY = gy + gh; }
+      empty = false;
+    }
+    x += g->xadvance;
+  }
+
+  e->x = minX;
+  e->y = minY;
+  e->image = NULL;
+  e->baked = font->antialiasing == R_AA_GRAYSCALE && !textBlend.linear;
+  if (empty) { return true; }
+  int stride = (maxX - minX + IMAGE_ROW_ALIGN - 1) & ~(IMAGE_ROW_ALIGN - 1);
+  size_t bytes = (size_t) stride * (maxY - minY) * sizeof(RColor);
+  if (sizeof(LineEntry) + strlen(text) + 1 + bytes > lineCacheBudget) { return false; }
+
+  RImage *image = RNewImage(maxX - minX, maxY - minY);
+  memset(image->pixels, 0, image->stride * image->height * sizeof(RColor));
+  image->format = font->antialiasing == R_AA_SUBPIXEL ? R_PIXEL_SUBPIXEL : R_PIXEL_PREMULTIPLIED;
+  /* composited from glyphs already in the target order */
+  image->swapped = layout == LAYOUT_BGRA;
+  RColor pcolor = premultiplyColor(nativeColor(color));
+
+  x = 0;
+  p = text;
+  while (*p) {
+    p = utf8ToCodepoint(p, &codepoint);
+    GlyphSet *set = getGlyphset(font, codepoint);
+    setImageOrder(set->image, R_ORDER_NATIVE);
+    stbtt_bakedchar *g = &set->glyphs[codepoint & 0xff];
+    int gw = g->x1 - g->x0, gh = g->y1 - g->y0;
+    RColor *d = image->pixels + (x + (int) g->xoff - minX) + ((int) g->yoff - minY) * image->stride;
+    RColor *s = set->image->pixels + g->x0 + g->y0 * set->image->stride;
+    for (int j = 0; j < gh; j++) {
+      for (int i = 0; i < gw; i++) {
+        if (image->format == R_PIXEL_SUBPIXEL) {
+          /* overlapping coverages combine like two blends would */
+          d[i].r = s[i].r + mul255(d[i].r, 0xff - s[i].r);
+          d[i].g = s[i].g + mul255(d[i].g, 0xff - s[i].g);
+          d[i].b = s[i].b + mul255(d[i].b, 0xff - s[i].b);
+          d[i].a = s[i].a + mul255(d[i].a, 0xff - s[i].a);
+        } else if (e->baked) {
+          d[i] = blendPixelPremul2(d[i], s[i], pcolor);
+        } else {
+          d[i] = blendPixelPremul(d[i], s[i]);
+        }
+      }
+      d += image->stride;
+      s += set->image->stride;
+    }
+    x += g->xadvance;
+  }
+
+  e->image = image;
+  return true;
+}
+
+static LineEntry* getLine (RFont *font, const char *text, RColor color)
+{
+  uint64_t hash = hashLine(font, text, color);
+  LineEntry **bucket = &lineCache.buckets[hash % LINE_CACHE_BUCKETS];
+  for (LineEntry *e = *bucket; e; e = e->next) {
+    if (e->hash == hash && e->font == font && !strcmp(e->text, text)) {
+      unlinkLru(e);
+      pushLru(e);
+      return e;
+    }
+  }
+
+  LineEntry *e = (LineEntry*) checkAlloc(calloc(1, sizeof(LineEntry)));
+  if (!renderLine(e, font, text, color)) {
+    free(e);
+    return NULL;
+  }
+  size_t len = strlen(text);
+  e->text = (char*) checkAlloc(malloc(len + 1));
+  memcpy(e->text, text, len + 1);
+  e->hash = hash;
+  e->font = font;
+  e->bytes = sizeof(LineEntry) + len + 1;
+  if (e->image) { e->bytes += e->image->stride * e->image->height * sizeof(RColor); }
+
+  trimLines(lineCacheBudget > e->bytes ? lineCacheBudget - e->bytes : 0);
+  bucket = &lineCache.buckets[hash % LINE_CACHE_BUCKETS];
+  e->next = *bucket;
+  *bucket = e;
+  pushLru(e);
+  lineCache.bytes += e->bytes;
+  return e;
+}
+
+void RDrawText (RFont *font, const char *text, int x, int y, RColor color)
+{
+  /* glyphs stay within a font height above and below y */
+  int height = getGlyphCache(font)->height;
+  if (color.a == 0 || x >= clip.right || y - height >= clip.bottom || y + height <= clip.top) {
+    return;
+  }
+
+  /* lines too big for the cache are drawn glyph by glyph */
+  LineEntry *e = lineCacheBudget > 0 && *text ? getLine(font, text, color) : NULL;
+  if (e) {
+    if (e->image) {
+      RRect sub = { 0, 0, e->image->width, e->image->height };
+      RColor white = { 0xff, 0xff, 0xff, 0xff };
+      drawImage(getTarget(), e->image, &sub, x + e->x, y + e->y, e->baked ? white : color, true);
+    }
+    return;
+  }
+
+  SDL_Surface *surf = getTarget();
+  RRect rect;
+  const char *p = text;
+  unsigned codepoint;
+  while (*p) {
+    p = utf8ToCodepoint(p, &codepoint);
+    GlyphSet *set = getGlyphset(font, codepoint);
+    stbtt_bakedchar *g = &set->glyphs[codepoint & 0xff];
+    rect.x = g->x0;
+    rect.y = g->y0;
+    rect.width = g->x1 - g->x0;
+    rect.height = g->y1 - g->y0;
+    drawImage(surf, set->image, &rect, x + g->xoff, y + g->yoff, color, true);
+    x += g->xadvance;
+  }
+}
+
+/// Scaled drawing
+
+/// rows summed per box before the 16 bit sums could overflow
+#define BOX_ROWS_MAX 257
+
+enum { SCRATCH_COLUMNS, SCRATCH_WEIGHTS, SCRATCH_SOURCE, SCRATCH_ROW, SCRATCH_MAX };
+
+/// per call buffers of RDrawImageScaled, kept between calls
+static void* scratch (int slot, size_t bytes)
+{
+  static void *bufs[SCRATCH_MAX];
+  static size_t sizes[SCRATCH_MAX];
+  if (bytes > sizes[slot]) {
+    bufs[slot] = checkAlloc(realloc(bufs[slot], bytes));
+    sizes[slot] = bytes;
+  }
+  return bufs[slot];
+}
+
+/// blends a row of already sampled pixels
+static void blendRow (RColor *d, const RColor *s, int w, RPixelFormat format, RColor color)
+{
+  int i = 0;
+  bool opaqueWhite =
+    color.r == 0xff && color.g == 0xff && color.b == 0xff && color.a == 0xff;
+
+  if (format == R_PIXEL_PREMULTIPLIED && opaqueWhite) {
+#ifdef __SSE2__
+    for (; i + 4 <= w; i += 4) {
+      __m128i src = _mm_loadu_si128((__m128i*) (s + i));
+      __m128i dst = _mm_loadu_si128((__m128i*) (d + i));
+      _mm_storeu_si128((__m128i*) (d + i), blend4Premul(dst, src));
+    }
+#endif
+    for (; i < w; i++) { d[i] = blendPixelPremul(d[i], s[i]); }
+  } else if (format == R_PIXEL_PREMULTIPLIED) {
+    RColor pcolor = premultiplyColor(color);
+    for (; i < w; i++) { d[i] = blendPixelPremul2(d[i], s[i], pcolor); }
+  } else if (format == R_PIXEL_SUBPIXEL) {
+    for (; i < w; i++) { d[i] = blendPixelSubpixel(d[i], s[i], color); }
+  } else {
+    for (; i < w; i++) { d[i] = blendPixel2(d[i], s[i], color); }
+  }
+}
+
+/// out = a + (b - a) * f / 256 rounded, per channel
+static void lerpRows (RColor *out, const RColor *a, const RColor *b, int n, int f)
+{
+  int i = 0;
+#ifdef __SSE2__
+  __m128i zero = _mm_setzero_si128();
+  __m128i wa = _mm_set1_epi16(256 - f);
+  __m128i wb = _mm_set1_epi16(f);
+  __m128i round = _mm_set1_epi16(0x80);
+  for (; i + 4 <= n; i += 4) {
+    __m128i pa = _mm_loadu_si128((__m128i*) (a + i));
+    __m128i pb = _mm_loadu_si128((__m128i*) (b + i));
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pa, zero), wa),
+                               _mm_mullo_epi16(_mm_unpacklo_epi8(pb, zero), wb));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pa, zero), wa),
+                               _mm_mullo_epi16(_mm_unpackhi_epi8(pb, zero), wb));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+    _mm_storeu_si128((__m128i*) (out + i), _mm_packus_epi16(lo, hi));
+  }
+#endif
+  for (; i < n; i++) {
+    out[i].r = (a[i].r * (256 - f) + b[i].r * f + 0x80) >> 8;
+    out[i].g = (a[i].g * (256 - f) + b[i].g * f + 0x80) >> 8;
+    out[i].b = (a[i].b * (256 - f) + b[i].b * f + 0x80) >> 8;
+    out[i].a = (a[i].a * (256 - f) + b[i].a * f + 0x80) >> 8;
+  }
+}
+
+/// out[i] = src[columns[i]] lerped towards its right neighbour by weights[i],
+/// src holds one readable pixel past the last column
+static void lerpColumns (RColor *out, const RColor *src, const int *columns,
+                         const uint16_t *weights, int n)
+{
+  int i = 0;
+#ifdef __SSE2__
+  __m128i zero = _mm_setzero_si128();
+  __m128i round = _mm_set1_epi16(0x80);
+  for (; i + 2 <= n; i += 2) {
+    /* [a0 b0 a1 b1], each pixel next to its right neighbour */
+    __m128i p = _mm_unpacklo_epi64(
+      _mm_loadl_epi64((__m128i*) (src + columns[i])),
+      _mm_loadl_epi64((__m128i*) (src + columns[i + 1])));
+    __m128i w0 = _mm_unpacklo_epi64(_mm_set1_epi16(256 - weights[i]), _mm_set1_epi16(weights[i]));
+    __m128i w1 = _mm_unpacklo_epi64(_mm_set1_epi16(256 - weights[i + 1]), _mm_set1_epi16(weights[i + 1]));
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(p, zero), w0);
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(p, zero), w1);
+    lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, _mm_srli_si128(lo, 8)), round), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, _mm_srli_si128(hi, 8)), round), 8);
+    __m128i px = _mm_packus_epi16(_mm_unpacklo_epi64(lo, hi), zero);
+    _mm_storel_epi64((__m128i*) (out + i), px);
+  }
+#endif
+  for (; i < n; i++) {
+    const RColor *a = src + columns[i];
+    int f = weights[i];
+    out[i].r = (a[0].r * (256 - f) + a[1].r * f + 0x80) >> 8;
+    out[i].g = (a[0].g * (256 - f) + a[1].g * f + 0x80) >> 8;
+    out[i].b = (a[0].b * (256 - f) + a[1].b * f + 0x80) >> 8;
+    out[i].a = (a[0].a * (256 - f) + a[1].a * f + 0x80) >> 8;
+  }
+}
+
+/// adds n pixels to 16 bit per channel sums
+static void accumulateRow (uint16_t *acc, const RColor *src, int n)
+{
+  int i = 0;
+#ifdef __SSE2__
+  __m128i zero = _mm_setzero_si128();
+  for (; i + 4 <= n; i += 4) {
+    __m128i p = _mm_loadu_si128((__m128i*) (src + i));
+    __m128i *a = (__m128i*) (acc + i * 4);
+    _mm_storeu_si128(a, _mm_add_epi16(_mm_loadu_si128(a), _mm_unpacklo_epi8(p, zero)));
+    _mm_storeu_si128(a + 1, _mm_add_epi16(_mm_loadu_si128(a + 1), _mm_unpackhi_epi8(p, zero)));
+  }
+#endif
+  for (; i < n; i++) {
+    acc[i * 4 + 0] += src[i].r;
+    acc[i * 4 + 1] += src[i].g;
+    acc[i * 4 + 2] += src[i].b;
+    acc[i * 4 + 3] += src[i].a;
+  }
+}
+
+/// out[i] = average of counts[i] sums from columns[i] on, each made of rows pixels
+static void averageColumns (RColor *out, const uint16_t *acc, const int *columns,
+                            const uint16_t *counts, int rows, int n)
+{
+  uint32_t lastTotal = 0;
+  uint64_t recip = 0;
+  uint64_t half = 1ULL << 31;
+  for (int i = 0; i < n; i++) {
+    const uint16_t *a = acc + columns[i] * 4;
+    uint32_t sum[4] = { 0, 0, 0, 0 };
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i v = zero;
+    for (int k = 0; k < counts[i]; k++) {
+      v = _mm_add_epi32(v, _mm_unpacklo_epi16(_mm_loadl_epi64((__m128i*) (a + k * 4)), zero));
+    }
+    _mm_storeu_si128((__m128i*) sum, v);
+#else
+    for (int k = 0; k < counts[i] * 4; k += 4) {
+      sum[0] += a[k]; sum[1] += a[k + 1]; sum[2] += a[k + 2]; sum[3] += a[k + 3];
+    }
+#endif
+    /* 0.32 reciprocal, neighbouring boxes mostly share their size */
+    uint32_t total = counts[i] * rows;
+    if (total != lastTotal) {
+      recip = ((1ULL << 32) + total / 2) / total;
+      lastTotal = total;
+    }
+    out[i].r = (sum[0] * recip + half) >> 32;
+    out[i].g = (sum[1] * recip + half) >> 32;
+    out[i].b = (sum[2] * recip + half) >> 32;
+    out[i].a = (sum[3] * recip + half) >> 32;
+  }
+}
+
+/// 16.16 source position of the center of destination pixel k,
+/// shifted so the integer part is the left/top sample of a bilinear pair
+static inline int64_t bilinearPos (int k, int srcSize, int dstSize)
+{
+  return (((int64_t) (2 * k + 1) * srcSize << 16) / (2 * dstSize)) - (1 << 15);
+}
+
+/// splits a bilinear position into the first sample and its 8 bit weight
+static inline int bilinearSample (int64_t pos, int size, uint16_t *weight)
+{
+  if (pos < 0) { *weight = 0; return 0; }
+  int i = pos >> 16;
+  if (i >= size - 1) { *weight = 0; return size - 1; }
+  *weight = (pos >> 8) & 0xff;
+  return i;
+}
+
+/// draws sub stretched over dst. Nearest keeps icons crisp, bilinear
+/// suits enlarging and mild shrinking, box averages every covered source
+/// pixel and is the one for large reductions such as the minimap.
+/// Filtering mixes neighbouring pixels, so straight alpha images bleed
+/// the color of transparent pixels, premultiplied ones filter cleanly.
+void RDrawImageScaled (RImage *image, RRect *sub, RRect dst, RColor color, RFilter filter)
+{
+  if (color.a == 0 || sub->width <= 0 || sub->height <= 0) { return; }
+  if (clipRejects(dst.x, dst.y, dst.width, dst.height)) { return; }
+
+  int x1 = dst.x < clip.left ? clip.left : dst.x;
+  int y1 = dst.y < clip.top  ? clip.top  : dst.y;
+  int x2 = dst.x + dst.width;
+  int y2 = dst.y + dst.height;
+  x2 = x2 > clip.right  ? clip.right  : x2;
+  y2 = y2 > clip.bottom ? clip.bottom : y2;
+  if (x1 >= x2 || y1 >= y2) { return; }
+
+  int w = x2 - x1;
+  int sw = sub->width, sh = sub->height;
+  int *columns = (int*) scratch(SCRATCH_COLUMNS, w * sizeof(int));
+  uint16_t *weights = (uint16_t*) scratch(SCRATCH_WEIGHTS, w * sizeof(uint16_t));
+  RColor *row = (RColor*) scratch(SCRATCH_ROW, w * sizeof(RColor));
+
+  /* source columns of every visible destination column, relative to the
+   * first one so the row buffers only cover what is actually sampled */
+  int first = 0, span = 0;
+  if (filter == R_FILTER_BILINEAR) {
+    for (int i = 0; i < w; i++) {
+      columns[i] = bilinearSample(bilinearPos(x1 + i - dst.x, sw, dst.width), sw, &weights[i]);
+    }
+    first = columns[0];
+    span = (columns[w - 1] < sw - 1 ? columns[w - 1] + 2 : sw) - first;
+  } else if (filter == R_FILTER_BOX) {
+    for (int i = 0; i < w; i++) {
+      int k = x1 + i - dst.x;
+      int c0 = (int64_t) k * sw / dst.width;
+      int c1 = (int64_t) (k + 1) * sw / dst.width;
+      columns[i] = c0;
+      weights[i] = c1 > c0 ? c1 - c0 : 1;
+    }
+    first = columns[0];
+    span = columns[w - 1] + weights[w - 1] - first;
+  } else {
+    /* 16.16 fixed point steps through the source, sampling pixel centers */
+    int64_t stepX = ((int64_t) sw << 16) / dst.width;
+    for (int i = 0; i < w; i++) {
+      columns[i] = ((x1 + i - dst.x) * stepX + stepX / 2) >> 16;
+    }
+  }
+  for (int i = 0; i < w; i++) { columns[i] -= first; }
+
+  SDL_Surface *surf = getTarget();
+  color = nativeColor(color);
+  setImageOrder(image, R_ORDER_NATIVE);
+  RColor *base = image->pixels + sub->x + first + sub->y * image->stride;
+  RColor *src = NULL;
+  uint16_t *acc = NULL;
+  if (filter == R_FILTER_BILINEAR) {
+    src = (RColor*) scratch(SCRATCH_SOURCE, (span + 1) * sizeof(RColor));
+  } else if (filter == R_FILTER_BOX) {
+    acc = (uint16_t*) scratch(SCRATCH_SOURCE, span * 4 * sizeof(uint16_t));
+  }
+
+  for (int j = y1; j < y2; j++) {
+    int k = j - dst.y;
+    RColor *d = (RColor*) surf->pixels + x1 + j * surf->w;
+
+    if (filter == R_FILTER_BILINEAR) {
+      uint16_t fy;
+      int r = bilinearSample(bilinearPos(k, sh, dst.height), sh, &fy);
+      RColor *a = base + r * image->stride;
+      lerpRows(src, a, fy ? a + image->stride : a, span, fy);
+      src[span] = src[span - 1];
+      lerpColumns(row, src, columns, weights, w);
+    } else if (filter == R_FILTER_BOX) {
+      int r0 = (int64_t) k * sh / dst.height;
+      int r1 = (int64_t) (k + 1) * sh / dst.height;
+      int rows = r1 - r0 < 1 ? 1 : r1 - r0;
+      if (rows > BOX_ROWS_MAX) { rows = BOX_ROWS_MAX; }
+      memset(acc, 0, span * 4 * sizeof(uint16_t));
+      for (int r = r0; r < r0 + rows; r++) {
+        accumulateRow(acc, base + r * image->stride, span);
+      }
+      averageColumns(row, acc, columns, weights, rows, w);
+    } else {
+      int64_t stepY = ((int64_t) sh << 16) / dst.height;
+      RColor *s = base + ((k * stepY + stepY / 2) >> 16) * image->stride;
+      for (int i = 0; i < w; i++) { row[i] = s[columns[i]]; }
+    }
+
+    blendRow(d, row, w, image->format, color);
+  }
+}
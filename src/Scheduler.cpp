@@ -0,0 +1,92 @@
+#include <SDL2/SDL.h>
+#include <assert.h>
+#include "include/Scheduler.hpp"
+
+#define SCHED_TASKS_MAX 64
+
+typedef struct {
+  SchedTaskFn fn;
+  void *udata;
+} Task;
+
+/// one ring of tasks per priority, a task that still has work goes to
+/// the back of its ring so tasks of the same priority take turns
+static struct {
+  Task tasks[SCHED_TASKS_MAX];
+  int head, count;
+} queues[SCHED_PRIORITIES];
+
+static double frameDeadline;
+
+double SchedTime (void)
+{
+  static double period;
+  if (period == 0) { period = 1.0 / SDL_GetPerformanceFrequency(); }
+  return SDL_GetPerformanceCounter() * period;
+}
+
+void SchedBeginFrame (double budget)
+{
+  frameDeadline = SchedTime() + budget;
+}
+
+double SchedFrameDeadline (void)
+{
+  return frameDeadline;
+}
+
+static Task* taskAt (int priority, int i)
+{
+  return &queues[priority].tasks[(queues[priority].head + i) % SCHED_TASKS_MAX];
+}
+
+bool SchedAdd (SchedPriority priority, SchedTaskFn fn, void *udata)
+{
+  assert(priority >= 0 && priority < SCHED_PRIORITIES);
+  for (int i = 0; i < queues[priority].count; i++) {
+    Task *t = taskAt(priority, i);
+    if (t->fn == fn && t->udata == udata) { return true; }
+  }
+  if (queues[priority].count == SCHED_TASKS_MAX) { return false; }
+  *taskAt(priority, queues[priority].count++) = (Task) { fn, udata };
+  return true;
+}
+
+void SchedRemove (SchedTaskFn fn, void *udata)
+{
+  for (int p = 0; p < SCHED_PRIORITIES; p++) {
+    int kept = 0;
+    for (int i = 0; i < queues[p].count; i++) {
+      Task t = *taskAt(p, i);
+      if (t.fn != fn || t.udata != udata) { *taskAt(p, kept++) = t; }
+    }
+    queues[p].count = kept;
+  }
+}
+
+bool SchedRun (double deadline)
+{
+  for (int p = 0; p < SCHED_PRIORITIES; p++) {
+    /* every queued task gets at most one turn per call */
+    for (int n = queues[p].count; n > 0 && queues[p].count > 0; n--) {
+      if (SchedTime() >= deadline) { return SchedPending(); }
+      Task t = *taskAt(p, 0);
+      queues[p].head = (queues[p].head + 1) % SCHED_TASKS_MAX;
+      queues[p].count--;
+      if (t.fn(t.udata, deadline)) {
+        SchedAdd((SchedPriority) p, t.fn, t.udata);
+      }
+    }
+    /* lower priorities only run once this one is done */
+    if (queues[p].count > 0) { return true; }
+  }
+  return false;
+}
+
+bool SchedPending (void)
+{
+  for (int p = 0; p < SCHED_PRIORITIES; p++) {
+    if (queues[p].count > 0) { return true; }
+  }
+  return false;
+}
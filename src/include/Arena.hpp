@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+
+/// Size classed slab allocator for renderer objects (images, glyph sets).
+/// Every block is ARENA_ALIGN aligned so pixel rows can be walked with SIMD.
+/// Not thread safe, the renderer only runs on the main thread.
+
+#define ARENA_ALIGN 64
+#define ARENA_CLASSES 84
+
+typedef struct {
+  size_t bytesInUse;      /* live blocks, rounded up to their class */
+  size_t bytesCached;     /* freed blocks waiting to be reused */
+  size_t bytesReserved;   /* obtained from the system */
+  size_t allocs, frees, reuses;
+  int blocksInUse[ARENA_CLASSES];
+  int blocksCached[ARENA_CLASSES];
+} ArenaStats;
+
+void* ArenaAlloc (size_t size);
+void ArenaFree (void *ptr, size_t size);
+
+/// gives the cached big blocks back to the system, returns the bytes released.
+/// Without it at most 32MB of them are kept
+size_t ArenaTrim (void);
+
+void ArenaGetStats (ArenaStats *stats);
+/// block size of a class, for reading the stats
+size_t ArenaClassSize (int sizeClass);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include "lib/lua52/lua.h"
+
+/// lua_Alloc with per thread free lists for the small objects Lua churns
+/// through (strings, tables, nodes, closures). Blocks up to LUA_POOL_MAX
+/// bytes come from LUA_POOL_CLASSES size classes carved out of slabs,
+/// bigger ones go to realloc/free like the stock allocator.
+
+#define LUA_POOL_STEP 16
+#define LUA_POOL_MAX 256
+#define LUA_POOL_CLASSES (LUA_POOL_MAX / LUA_POOL_STEP)
+
+typedef struct {
+  size_t blocks;      /* live blocks */
+  size_t bytes;       /* live bytes as requested by Lua */
+  size_t allocs;
+  size_t cached;      /* freed blocks waiting to be reused */
+} LuaPoolClass;
+
+typedef struct {
+  LuaPoolClass classes[LUA_POOL_CLASSES];
+  LuaPoolClass large; /* past LUA_POOL_MAX, cached stays 0 */
+  size_t slabBytes;
+} LuaAllocStats;
+
+void* LuaAlloc (void *ud, void *ptr, size_t osize, size_t nsize);
+
+/// luaL_newstate using LuaAlloc, or LuaAllocTracked with track set
+lua_State* LuaNewState (bool track);
+
+/// counters of the calling thread
+void LuaAllocGetStats (LuaAllocStats *stats);
+
+/// Memory attribution. LuaAllocTracked puts a tag in front of every
+/// block naming the chunk that was running when it was allocated, and
+/// keeps live bytes per chunk. The running chunk isn't looked up per
+/// allocation: a count hook samples lua_getinfo every
+/// LUA_TAG_SAMPLE_COUNT instructions and maps the chunk's short_src to
+/// a tag through a small cache, chunks with the same short_src share one. Allocations made in between, or from C, go
+/// to the last chunk sampled. Tag 0 gathers what ran before the first
+/// sample and everything past LUA_TAGS_MAX sources.
+
+#define LUA_TAGS_MAX 256
+#define LUA_TAG_SAMPLE_COUNT 1000
+
+typedef struct {
+  char source[LUA_IDSIZE];  /* short_src of the chunk */
+  size_t bytes;             /* live bytes as requested by Lua */
+  size_t blocks;            /* live blocks */
+  size_t allocs;
+} LuaAllocTag;
+
+void* LuaAllocTracked (void *ud, void *ptr, size_t osize, size_t nsize);
+
+/// copies up to max tags sorted by live bytes, returns how many.
+/// max is clamped to [0, LUA_TAGS_MAX]
+int LuaAllocGetTags (LuaAllocTag *tags, int max);
+/// the top tags as a table, one line per chunk
+void LuaAllocDumpTags (FILE *fp, int max);
+
+/// `memory` Lua module: tracking() tells whether the state was created
+/// tracked, report([max]) returns { source, bytes, blocks, allocs }
+/// tables biggest first, dump([max]) writes the same to the log
+int luaopen_memory (lua_State *L);
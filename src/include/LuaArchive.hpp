@@ -0,0 +1,18 @@
+#pragma once
+
+#include "lib/lua52/lua.h"
+
+/// Single file module archive: a hash index of module names followed by
+/// each module's bytecode. The build packs the compiled modules into one,
+/// at startup it is mmap'd and a searcher placed before the file searcher
+/// resolves require with one index lookup, no filesystem probes.
+/// Modules missing from the archive go through the other searchers.
+
+/// Installs the searcher for the archive at path, which stays mapped
+/// for as long as L lives. False if it can't be opened or isn't one.
+bool LuaArchiveOpen (lua_State *L, const char *path);
+
+/// Compiles every .lua file under dir into the archive out. Names follow
+/// package.path: dir/a/b.lua is a.b, dir/a/init.lua is a unless a.lua
+/// exists. False with the reason on top of L's stack on failure.
+bool LuaArchivePack (lua_State *L, const char *dir, const char *out);
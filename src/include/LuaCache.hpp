@@ -0,0 +1,20 @@
+#pragma once
+
+#include "lib/lua52/lua.h"
+
+/// Bytecode cache for required Lua modules. Replaces the Lua file
+/// searcher of package.searchers with one that keeps lua_dump output in
+/// dir, one file per module, and loads that in binary mode when the
+/// source's mtime (to the nanosecond) and size, or failing those its
+/// content hash, still match. The source is parsed only when it actually changed.
+
+typedef struct {
+  unsigned hits;      /* loaded from the cache */
+  unsigned misses;    /* parsed and written to the cache */
+  unsigned failures;  /* cache could not be written */
+} LuaCacheStats;
+
+/// dir must exist and be writable, it is used as is. A dir longer than
+/// 4095 bytes leaves modules to the regular searcher
+void LuaCacheInit (lua_State *L, const char *dir);
+void LuaCacheGetStats (LuaCacheStats *stats);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include "lib/lua52/lua.h"
+
+/// Moves Lua garbage collection out of frames. The pause is raised so
+/// Lua doesn't start cycles by itself, and a cycle already under way is
+/// stopped while a frame runs. The work is done afterwards in small
+/// LUA_GCSTEP slices from the scheduler's SCHED_GC queue. Going past the memory ceiling forces
+/// a full collection whatever the frame budget says.
+
+#define LUAGC_HISTORY 128
+
+typedef struct {
+  size_t steps;
+  size_t cycles;       /* completed by stepping */
+  size_t forced;       /* full collections forced by the ceiling */
+  double total;        /* seconds spent collecting */
+  double max;          /* longest single pause */
+  /* latest pauses, history[(count - 1) % LUAGC_HISTORY] is the newest */
+  double history[LUAGC_HISTORY];
+  size_t count;
+} LuaGCStats;
+
+/// ceiling is in bytes, 0 means none
+void LuaGCInit (lua_State *L, size_t ceiling);
+void LuaGCBeginFrame (void);
+void LuaGCEndFrame (void);
+void LuaGCGetStats (LuaGCStats *stats);
+
+/// `gc` Lua module: get_stats() returns the counters above as a table,
+/// times in seconds, with the latest pauses oldest first in `pauses`
+int luaopen_gc (lua_State *L);
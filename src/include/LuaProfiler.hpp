@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include "lib/lua52/lua.h"
+
+/// Sampling profiler for Lua code. An ITIMER_PROF timer raises SIGPROF,
+/// whose handler only arms a count hook (lua_sethook is safe there); the
+/// hook then copies the Lua call stack into a preallocated ring.
+/// Stacks are aggregated from the scheduler's SCHED_PROFILE queue and
+/// written as folded stacks ("a;b;c count" lines) for flamegraph tools.
+/// A sample lands on the next Lua instruction, so CPU time spent in C
+/// with no Lua on the stack is charged to whatever Lua runs next, and
+/// only the main thread is sampled, not coroutines.
+
+typedef struct {
+  size_t samples;  /* aggregated so far */
+  size_t stacks;   /* distinct folded stacks */
+  size_t dropped;  /* samples with no Lua function to charge */
+} LuaProfStats;
+
+/// samples L hz times per second of CPU time, false if already running
+bool LuaProfStart (lua_State *L, int hz);
+void LuaProfStop (void);
+bool LuaProfRunning (void);
+/// writes everything aggregated since the last reset
+bool LuaProfWrite (const char *path);
+void LuaProfReset (void);
+void LuaProfGetStats (LuaProfStats *stats);
+
+/// `profiler` Lua module: start([hz]), stop(), running(), write(path),
+/// reset(), so a command can toggle profiling while the editor runs
+int luaopen_profiler (lua_State *L);
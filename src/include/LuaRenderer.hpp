@@ -0,0 +1,9 @@
+#pragma once
+
+#include "lib/lua52/lua.h"
+
+/// `renderer` Lua module, the Renderer API as seen from Lua.
+/// Colors are packed 0xRRGGBBAA numbers (see renderer.color) and rects
+/// are passed as four numbers, so drawing calls allocate nothing.
+/// Fonts, images and batches are full userdata freed by __gc.
+int luaopen_renderer (lua_State *L);
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "lib/lua52/lua.h"
+
+/// `scheduler` Lua module, queues Lua functions on the frame scheduler:
+/// add(priority, fn) with priority "highlight" or "index", remove(fn)
+/// and time(). fn(deadline) is called with what is left of the frame or
+/// idle slice, in SchedTime() seconds, and returns true while it has more
+/// to do. Adding a function already queued does nothing.
+int luaopen_scheduler (lua_State *L);
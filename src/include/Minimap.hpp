@@ -0,0 +1,30 @@
+#pragma once
+
+#include "Renderer.hpp"
+
+/// Low resolution picture of a document, one pixel per character and
+/// MINIMAP_LINE_HEIGHT pixels per line. Characters are drawn as blocks
+/// shaded by how much ink they usually carry, no glyphs involved.
+/// Only the lines handed to MinimapSetLine are redrawn, inserting or
+/// removing lines moves the rows below without redrawing them.
+
+#define MINIMAP_LINE_HEIGHT 2
+
+typedef struct Minimap Minimap;
+
+/// columns is the widest line shown, longer lines are cut
+Minimap* MinimapNew (int columns, int tabWidth);
+void MinimapFree (Minimap *map);
+
+/// inserted lines start empty
+void MinimapInsertLines (Minimap *map, int line, int count);
+void MinimapRemoveLines (Minimap *map, int line, int count);
+int MinimapGetLineCount (Minimap *map);
+
+/// colors holds one color per byte of text (syntax colors),
+/// NULL draws the line in white and leaves the color to MinimapDraw
+void MinimapSetLine (Minimap *map, int line, const char *text, const RColor *colors);
+
+/// draws the lines from firstLine on into dst, each minimap pixel
+/// becomes dst.width / columns pixels wide and high
+void MinimapDraw (Minimap *map, int firstLine, RRect dst, RColor color);
@@ -2,6 +2,7 @@
 
 #include <SDL2/SDL.h>
 #include <stdint.h>
+#include <stddef.h>
 
 typedef struct RImage RImage;
 typedef struct RFont RFont;
@@ -9,28 +10,96 @@ typedef struct RFont RFont;
 typedef struct { uint8_t r, g, b, a; } RColor;
 typedef struct { int x, y, width, height; } RRect;
 
+/// Batched drawing commands
+typedef struct { RRect rect; RColor color; } RRectCmd;
+typedef struct { RRect sub; int x, y; } RImageCmd;
+
+/// RImage pixel formats, premultiplied images skip the
+/// per pixel alpha multiply when drawn, subpixel images hold
+/// one coverage per channel (LCD glyphs)
+typedef enum { R_PIXEL_STRAIGHT, R_PIXEL_PREMULTIPLIED, R_PIXEL_SUBPIXEL } RPixelFormat;
+
+/// RImage byte orders, RGBA is the order of RColor and the one new images
+/// start in. Images are drawn in the window's order (native), an image in
+/// the other one is converted in place the first time it is drawn
+typedef enum { R_ORDER_RGBA, R_ORDER_NATIVE } RByteOrder;
+
+typedef enum { R_AA_GRAYSCALE, R_AA_SUBPIXEL } RAntialiasing;
+
+/// Sampling of RDrawImageScaled
+typedef enum { R_FILTER_NEAREST, R_FILTER_BILINEAR, R_FILTER_BOX } RFilter;
+
 /// Init SDL window
 /// It does not create the window it should be provided
-void RInit (SDL_Window *win);
+/// scale is the number of physical pixels per logical pixel
+void RInit (SDL_Window *win, float scale);
+void RSetScale (float scale);
+
+/// pushes nest at most R_CLIP_STACK_MAX deep
+#define R_CLIP_STACK_MAX 64
 
 void RSetClipRect (RRect rect);
-void RGetSize (int *x, int *y);
+void RPushClipRect (RRect rect);
+void RPopClipRect (void);
+int RGetClipDepth (void);
+void RGetSize (int *x, int *y, float *scale);
 void RUpdateRects (RRect *rects, int count);
+/// present only what changed since the last presented frame
+void RSetPresentDiffing (bool enable);
 
 /// RImage creation
 RImage* RNewImage(int w, int h);
 void RFreeImage(RImage *image);
+/// rows are stride pixels apart, for code that fills images itself.
+/// The pixels are converted to order first, code that keeps updating an
+/// image between draws asks for R_ORDER_NATIVE and writes RNativeColor colors
+RColor* RGetImagePixels (RImage *image, int *stride, RByteOrder order);
+RColor RNativeColor (RColor color);
+void RConvertImage(RImage *image, RPixelFormat format);
 
 /// RFont
 RFont* RLoadFont (const char *filename, float size);
 void RFreeFont (RFont *font);
+void RSetFontAntialiasing (RFont *font, RAntialiasing mode);
 void RSetFontTabWidth (RFont *font, int w);
 int RGetFontTabWidth (RFont *font);
 int RGetFontWidth (RFont *font, const char *text);
 int RGetFontHeigh (RFont *font);
 
+/// Font statistics, lastUsed is the frame (RUpdateRects call) of the last lookup
+typedef struct {
+  int firstCodepoint;
+  float scale;          /* display scale the set was rasterized for */
+  int width, height;    /* atlas */
+  size_t bytes;
+  unsigned accesses;
+  unsigned lastUsed;
+  double bakeTime;      /* seconds spent rasterizing the set */
+} RGlyphSetStats;
+
+typedef struct {
+  int sets;
+  size_t bytes;
+  unsigned bakes;       /* sets rasterized so far, freed ones included */
+  double bakeTime;
+  unsigned frame;       /* current frame */
+} RFontStats;
+
+/// fills at most max entries of sets, returns how many were filled
+int RGetFontStats (RFont *font, RFontStats *stats, RGlyphSetStats *sets, int max);
+/// frees the sets not used in the last age frames, returns the bytes released
+size_t RTrimFont (RFont *font, unsigned age);
+
+/// Text blending
+void RSetTextBlending (bool linear, float contrast, float darken);
+/// budget of the rendered line cache in bytes, 0 disables it
+void RSetLineCacheBudget (size_t bytes);
+
 /// Drawing
 
 void RDrawRect (RRect rect, RColor color);
 void RDrawImage (RImage *image, RRect *sub, int x, int y, RColor color);
+void RDrawImageScaled (RImage *image, RRect *sub, RRect dst, RColor color, RFilter filter);
+void RDrawRects (const RRectCmd *cmds, int count);
+void RDrawImageBatch (RImage *image, const RImageCmd *cmds, int count, RColor color);
 void RDrawText (RFont *font, const char *text, int x, int y, RColor color);
\ No newline at end of file
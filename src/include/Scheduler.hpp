@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+
+/// Deferred work, run in priority order with whatever is left of the
+/// frame budget and in short slices while the editor is idle
+
+typedef enum {
+  SCHED_HIGHLIGHT,       /* syntax highlighting */
+  SCHED_GLYPH_PREFETCH,  /* baking glyph sets before they are drawn */
+  SCHED_GC,              /* Lua collector steps */
+  SCHED_INDEX,           /* file indexing */
+  SCHED_PROFILE,         /* folding profiler samples */
+  SCHED_PRIORITIES
+} SchedPriority;
+
+/// does a slice of work, stopping once SchedTime() passes deadline.
+/// returns true while it has more to do
+typedef bool (*SchedTaskFn) (void *udata, double deadline);
+
+/// seconds, monotonic
+double SchedTime (void);
+
+/// starts a frame that should be done budget seconds from now
+void SchedBeginFrame (double budget);
+double SchedFrameDeadline (void);
+
+/// queues a task, adding one already queued does nothing
+bool SchedAdd (SchedPriority priority, SchedTaskFn fn, void *udata);
+void SchedRemove (SchedTaskFn fn, void *udata);
+
+/// runs tasks until deadline, returns true if work is left over
+bool SchedRun (double deadline);
+bool SchedPending (void);
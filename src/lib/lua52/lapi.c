@@ -867,6 +867,17 @@ LUA_API void lua_setuservalue (lua_State *L, int idx) {
 }
 
 
+/* removing references never needs a GC barrier */
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  StkId t;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(L, ttistable(t), "table expected");
+  luaH_clear(hvalue(t));
+  lua_unlock(L);
+}
+
+
 /*
 ** `load' and `call' functions (run Lua code)
 */
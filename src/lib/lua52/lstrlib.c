@@ -533,6 +533,347 @@ static const char *lmemfind (const char *s1, size_t l1,
 }
 
 
+#if defined(LUA_USE_PATCACHE)	/* { */
+
+/*
+** {======================================================
+** PATTERN CACHE
+** A pattern is analyzed once and kept in a cache that the library
+** functions share as an upvalue. The analysis gives:
+** - the characters a match can start with, when the first item must
+**   consume one. Other positions are skipped without calling 'match'
+**   ('lmemfind' for a literal prefix, 'memchr' for a single character);
+** - for patterns made only of single character classes with optional
+**   suffixes (and a final '$'), a program run by 'simplematch' with
+**   bitmaps instead of re-reading the pattern.
+** Both give exactly the results of 'match'. Bitmaps cover ASCII only,
+** other bytes are checked against the pattern itself so that locale
+** changes are honored. Malformed patterns are left to 'match', which
+** reports the errors.
+** =======================================================
+*/
+
+#define PATCACHE_SIZE	256	/* entries, direct mapped */
+#define PATCACHE_KEYMAX	64	/* longer patterns are not cached */
+#define PATCACHE_ITEMS	16	/* items in a 'simplematch' program */
+#define PATCACHE_PREFIX	16	/* literal prefix kept for 'lmemfind' */
+
+
+typedef struct PatItem {
+  unsigned char set[16];  /* ASCII characters the class matches */
+  unsigned char p, ep;  /* the class is key[p..ep) */
+  char suffix;  /* '*', '+', '-', '?' or 0 */
+} PatItem;
+
+
+typedef struct PatEntry {
+  const char *src;  /* pattern string last seen, pinned in the cache */
+  size_t len;  /* 0 for a free slot, empty patterns are not cached */
+  char key[PATCACHE_KEYMAX + 1];
+  int hasfirst;  /* 'first' is the class every match starts with */
+  PatItem first;
+  int firstchar;  /* the only character 'first' matches, or -1 */
+  size_t prefixlen;
+  char prefix[PATCACHE_PREFIX];
+  int nitems;  /* -1: no program, use 'match' */
+  int dollar;  /* program ends with '$' */
+  PatItem items[PATCACHE_ITEMS];
+} PatEntry;
+
+
+/*
+** Entries are found by content. 'recent' finds them by address first:
+** the string an entry last matched is kept alive in the userdata's
+** user value (a table indexed like 'entries'), so an entry whose 'src'
+** is the very pattern passed in is known to hold that pattern.
+*/
+typedef struct PatCache {
+  PatEntry *recent[PATCACHE_SIZE];
+  PatEntry entries[PATCACHE_SIZE];
+} PatCache;
+
+
+/* 'singlematch' without the end of subject check */
+static int singleclass (int c, const char *p, const char *ep) {
+  switch (*p) {
+    case '.': return 1;
+    case L_ESC: return match_class(c, uchar(*(p+1)));
+    case '[': return matchbracketclass(c, p, ep-1);
+    default:  return (uchar(*p) == c);
+  }
+}
+
+
+/* 'classend' returning NULL instead of raising errors */
+static const char *safeclassend (const char *p, const char *pend) {
+  switch (*p++) {
+    case L_ESC: {
+      return (p == pend) ? NULL : p+1;
+    }
+    case '[': {
+      if (*p == '^') p++;
+      do {
+        if (p == pend) return NULL;
+        if (*(p++) == L_ESC && p < pend)
+          p++;
+      } while (*p != ']');
+      return p+1;
+    }
+    default: {
+      return p;
+    }
+  }
+}
+
+
+static void compileclass (PatItem *it, const char *key, const char *p,
+                          const char *ep) {
+  int c;
+  memset(it->set, 0, sizeof(it->set));
+  for (c = 0; c < 128; c++)
+    if (singleclass(c, p, ep))
+      it->set[c >> 3] |= 1 << (c & 7);
+  it->p = (unsigned char)(p - key);
+  it->ep = (unsigned char)(ep - key);
+  it->suffix = 0;
+}
+
+
+static int inclass (const PatItem *it, const char *key, int c) {
+  if (c < 128)
+    return (it->set[c >> 3] >> (c & 7)) & 1;
+  return singleclass(c, key + it->p, key + it->ep);
+}
+
+
+/* character a literal item stands for, or -1 */
+static int literalchar (const char *p, const char *ep) {
+  if (*p == L_ESC)
+    return (ep - p == 2 && !isalnum(uchar(*(p+1)))) ? uchar(*(p+1)) : -1;
+  if (ep - p != 1 || strchr(SPECIALS, *p) || *p == ')' || *p == ']')
+    return -1;
+  return uchar(*p);
+}
+
+
+static int hassuffix (const char *ep, const char *pend) {
+  return ep < pend && (*ep == '*' || *ep == '+' || *ep == '-' || *ep == '?');
+}
+
+
+/* the class at 'p' (position captures and captures skipped) must match */
+static void analyzefirst (PatEntry *pe) {
+  const char *key = pe->key;
+  const char *pend = key + pe->len;
+  const char *p = key;
+  const char *ep;
+  while (p < pend && *p == '(') {
+    p++;
+    if (p < pend && *p == ')') p++;  /* position capture */
+  }
+  if (p == pend || (*p == '$' && p + 1 == pend))
+    return;
+  if (*p == L_ESC && p + 1 < pend &&
+      (*(p+1) == 'b' || *(p+1) == 'f' || isdigit(uchar(*(p+1)))))
+    return;
+  if (*p == ')' || (ep = safeclassend(p, pend)) == NULL)
+    return;
+  if (hassuffix(ep, pend) && *ep != '+')
+    return;  /* may match the empty string */
+  compileclass(&pe->first, key, p, ep);
+  pe->hasfirst = 1;
+  pe->firstchar = literalchar(p, ep);
+  /* literal items with no suffix make a prefix */
+  while (p < pend && pe->prefixlen < PATCACHE_PREFIX) {
+    int c;
+    if ((ep = safeclassend(p, pend)) == NULL || hassuffix(ep, pend) ||
+        (c = literalchar(p, ep)) < 0)
+      break;
+    pe->prefix[pe->prefixlen++] = (char)c;
+    p = ep;
+  }
+}
+
+
+/* a program, when every item is a single character class */
+static void analyzeprogram (PatEntry *pe) {
+  const char *key = pe->key;
+  const char *pend = key + pe->len;
+  const char *p = key;
+  int n = 0;
+  while (p < pend) {
+    const char *ep;
+    PatItem *it;
+    if (*p == '$' && p + 1 == pend) {
+      pe->dollar = 1;
+      break;
+    }
+    if (*p == '(' || *p == ')' || n == PATCACHE_ITEMS)
+      return;
+    if (*p == L_ESC && p + 1 < pend &&
+        (*(p+1) == 'b' || *(p+1) == 'f' || isdigit(uchar(*(p+1)))))
+      return;
+    if ((ep = safeclassend(p, pend)) == NULL)
+      return;
+    it = &pe->items[n++];
+    compileclass(it, key, p, ep);
+    if (hassuffix(ep, pend))
+      it->suffix = *ep++;
+    p = ep;
+  }
+  pe->nitems = n;
+}
+
+
+/*
+** entry for the pattern at stack index 'arg', of which 'p' is the part
+** being matched (the anchor skipped). NULL when it is not cached and
+** 'match' is used as is
+*/
+static PatEntry *getpattern (lua_State *L, int cacheidx, int arg,
+                             const char *p, size_t lp) {
+  PatCache *pc = (PatCache *)lua_touserdata(L, lua_upvalueindex(cacheidx));
+  PatEntry **recent;
+  PatEntry *pe;
+  unsigned int h = (unsigned int)lp;
+  size_t i;
+  if (pc == NULL || lp == 0 || lp > PATCACHE_KEYMAX)
+    return NULL;
+  recent = &pc->recent[((size_t)p >> 3) % PATCACHE_SIZE];
+  if (*recent && (*recent)->src == p && (*recent)->len == lp)
+    return *recent;
+  for (i = 0; i < lp; i++)
+    h = h ^ ((h<<5) + (h>>2) + uchar(p[i]));
+  pe = &pc->entries[h % PATCACHE_SIZE];
+  if (pe->len != lp || memcmp(pe->key, p, lp) != 0) {
+    memset(pe, 0, sizeof(*pe));
+    memcpy(pe->key, p, lp);
+    pe->len = lp;
+    pe->firstchar = -1;
+    pe->nitems = -1;
+    analyzefirst(pe);
+    analyzeprogram(pe);
+  }
+  pe->src = p;
+  lua_getuservalue(L, lua_upvalueindex(cacheidx));
+  lua_pushvalue(L, arg);
+  lua_rawseti(L, -2, (int)(pe - pc->entries) + 1);
+  lua_pop(L, 1);
+  *recent = pe;
+  return pe;
+}
+
+
+static const char *simplematch (const PatEntry *pe, const char *s,
+                                const char *e, const PatItem *it) {
+  const PatItem *end = pe->items + pe->nitems;
+  for (; it < end; it++) {
+    switch (it->suffix) {
+      case '?': {
+        const char *res;
+        if (s < e && inclass(it, pe->key, uchar(*s)) &&
+            (res = simplematch(pe, s + 1, e, it + 1)) != NULL)
+          return res;
+        break;
+      }
+      case '+':
+        if (!(s < e && inclass(it, pe->key, uchar(*s))))
+          return NULL;
+        s++;
+        /* go through */
+      case '*': {
+        ptrdiff_t i = 0;
+        while (s + i < e && inclass(it, pe->key, uchar(*(s + i))))
+          i++;
+        if (it + 1 == end && !pe->dollar)
+          return s + i;  /* nothing left that could make it back off */
+        for (; i >= 0; i--) {
+          const char *res = simplematch(pe, s + i, e, it + 1);
+          if (res) return res;
+        }
+        return NULL;
+      }
+      case '-': {
+        for (;;) {
+          const char *res = simplematch(pe, s, e, it + 1);
+          if (res) return res;
+          if (s < e && inclass(it, pe->key, uchar(*s))) s++;
+          else return NULL;
+        }
+      }
+      default: {
+        if (!(s < e && inclass(it, pe->key, uchar(*s))))
+          return NULL;
+        s++;
+      }
+    }
+  }
+  if (pe->dollar && s != e)
+    return NULL;
+  return s;
+}
+
+
+static const char *domatch (MatchState *ms, const char *s, const char *p,
+                            const PatEntry *pe) {
+  const char *res;
+  if (pe == NULL)
+    return match(ms, s, p);
+  if (pe->hasfirst &&
+      (s == ms->src_end || !inclass(&pe->first, pe->key, uchar(*s))))
+    res = NULL;  /* cannot start here */
+  else if (pe->nitems < 0)
+    return match(ms, s, p);
+  else
+    res = simplematch(pe, s, ms->src_end, pe->items);
+#if defined(LUA_PATCACHE_VERIFY)
+  if (res != match(ms, s, p))
+    luaL_error(ms->L, "pattern cache mismatch for " LUA_QS, pe->key);
+#endif
+  return res;
+}
+
+
+/*
+** first position in [s, src_end) where a match of 'pe' (which has a
+** 'first' class) could start, NULL if there is none
+*/
+static const char *nextcandidate (MatchState *ms, const PatEntry *pe,
+                                  const char *s, const char *p) {
+  const char *e = ms->src_end;
+  const char *c;
+  if (pe->prefixlen > 1)
+    c = lmemfind(s, e - s, pe->prefix, pe->prefixlen);
+  else if (pe->firstchar >= 0)
+    c = (const char *)memchr(s, pe->firstchar, e - s);
+  else {
+    for (c = s; c < e && !inclass(&pe->first, pe->key, uchar(*c)); c++) ;
+    if (c == e) c = NULL;
+  }
+#if defined(LUA_PATCACHE_VERIFY)
+  {
+    const char *x;
+    for (x = s; x < (c ? c : e + 1); x++) {
+      ms->level = 0;
+      if (match(ms, x, p) != NULL)
+        luaL_error(ms->L, "pattern cache skipped a match of " LUA_QS, pe->key);
+    }
+  }
+#else
+  (void)p;
+#endif
+  return c;
+}
+
+/* }====================================================== */
+
+#else	/* }{ */
+
+#define domatch(ms,s,p,pe)	match(ms,s,p)
+
+#endif	/* } */
+
+
 static void push_onecapture (MatchState *ms, int i, const char *s,
                                                     const char *e) {
   if (i >= ms->level) {
@@ -598,6 +939,9 @@ static int str_find_aux (lua_State *L, int find) {
     MatchState ms;
     const char *s1 = s + init - 1;
     int anchor = (*p == '^');
+#if defined(LUA_USE_PATCACHE)
+    PatEntry *pe;
+#endif
     if (anchor) {
       p++; lp--;  /* skip anchor character */
     }
@@ -606,11 +950,19 @@ static int str_find_aux (lua_State *L, int find) {
     ms.src_init = s;
     ms.src_end = s + ls;
     ms.p_end = p + lp;
+#if defined(LUA_USE_PATCACHE)
+    pe = getpattern(L, 1, 2, p, lp);
+#endif
     do {
       const char *res;
+#if defined(LUA_USE_PATCACHE)
+      if (pe && pe->hasfirst && !anchor &&
+          (s1 = nextcandidate(&ms, pe, s1, p)) == NULL)
+        break;
+#endif
       ms.level = 0;
       lua_assert(ms.matchdepth == MAXCCALLS);
-      if ((res=match(&ms, s1, p)) != NULL) {
+      if ((res=domatch(&ms, s1, p, pe)) != NULL) {
         if (find) {
           lua_pushinteger(L, s1 - s + 1);  /* start */
           lua_pushinteger(L, res - s);   /* end */
@@ -642,18 +994,28 @@ static int gmatch_aux (lua_State *L) {
   const char *s = lua_tolstring(L, lua_upvalueindex(1), &ls);
   const char *p = lua_tolstring(L, lua_upvalueindex(2), &lp);
   const char *src;
+#if defined(LUA_USE_PATCACHE)
+  PatEntry *pe;
+#endif
   ms.L = L;
   ms.matchdepth = MAXCCALLS;
   ms.src_init = s;
   ms.src_end = s+ls;
   ms.p_end = p + lp;
+#if defined(LUA_USE_PATCACHE)
+  pe = getpattern(L, 4, lua_upvalueindex(2), p, lp);
+#endif
   for (src = s + (size_t)lua_tointeger(L, lua_upvalueindex(3));
        src <= ms.src_end;
        src++) {
     const char *e;
+#if defined(LUA_USE_PATCACHE)
+    if (pe && pe->hasfirst && (src = nextcandidate(&ms, pe, src, p)) == NULL)
+      break;
+#endif
     ms.level = 0;
     lua_assert(ms.matchdepth == MAXCCALLS);
-    if ((e = match(&ms, src, p)) != NULL) {
+    if ((e = domatch(&ms, src, p, pe)) != NULL) {
       lua_Integer newstart = e-s;
       if (e == src) newstart++;  /* empty match? go at least one position */
       lua_pushinteger(L, newstart);
@@ -670,7 +1032,12 @@ static int gmatch (lua_State *L) {
   luaL_checkstring(L, 2);
   lua_settop(L, 2);
   lua_pushinteger(L, 0);
+#if defined(LUA_USE_PATCACHE)
+  lua_pushvalue(L, lua_upvalueindex(1));  /* pattern cache */
+  lua_pushcclosure(L, gmatch_aux, 4);
+#else
   lua_pushcclosure(L, gmatch_aux, 3);
+#endif
   return 1;
 }
 
@@ -742,6 +1109,9 @@ static int str_gsub (lua_State *L) {
   size_t n = 0;
   MatchState ms;
   luaL_Buffer b;
+#if defined(LUA_USE_PATCACHE)
+  PatEntry *pe;
+#endif
   luaL_argcheck(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table expected");
@@ -754,11 +1124,23 @@ static int str_gsub (lua_State *L) {
   ms.src_init = src;
   ms.src_end = src+srcl;
   ms.p_end = p + lp;
+#if defined(LUA_USE_PATCACHE)
+  pe = getpattern(L, 1, 2, p, lp);
+#endif
   while (n < max_s) {
     const char *e;
+#if defined(LUA_USE_PATCACHE)
+    if (pe && pe->hasfirst && !anchor) {
+      /* copy up to the next place a match can start in one go */
+      const char *c = nextcandidate(&ms, pe, src, p);
+      if (c == NULL) break;
+      luaL_addlstring(&b, src, c - src);
+      src = c;
+    }
+#endif
     ms.level = 0;
     lua_assert(ms.matchdepth == MAXCCALLS);
-    e = match(&ms, src, p);
+    e = domatch(&ms, src, p, pe);
     if (e) {
       n++;
       add_value(&ms, &b, src, e, tr);
@@ -1012,7 +1394,15 @@ static void createmetatable (lua_State *L) {
 ** Open string library
 */
 LUAMOD_API int luaopen_string (lua_State *L) {
+#if defined(LUA_USE_PATCACHE)
+  luaL_newlibtable(L, strlib);
+  memset(lua_newuserdata(L, sizeof(PatCache)), 0, sizeof(PatCache));
+  lua_createtable(L, PATCACHE_SIZE, 0);  /* pinned pattern strings */
+  lua_setuservalue(L, -2);
+  luaL_setfuncs(L, strlib, 1);  /* the cache is every function's upvalue */
+#else
   luaL_newlib(L, strlib);
+#endif
   createmetatable(L);
   return 1;
 }
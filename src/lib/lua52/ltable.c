@@ -376,6 +376,28 @@ Table *luaH_new (lua_State *L) {
 }
 
 
+/*
+** empties 't' keeping the memory of both parts: slots are left as
+** 'setnodevector' creates them, so refilling the table up to its former
+** size neither rehashes nor allocates
+*/
+void luaH_clear (Table *t) {
+  int i;
+  for (i = 0; i < t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  if (!isdummy(t->node)) {  /* the shared dummy node is never written */
+    int size = sizenode(t);
+    for (i = 0; i < size; i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = NULL;
+      setnilvalue(gkey(n));
+      setnilvalue(gval(n));
+    }
+    t->lastfree = gnode(t, size);  /* all positions are free */
+  }
+}
+
+
 void luaH_free (lua_State *L, Table *t) {
   if (!isdummy(t->node))
     luaM_freearray(L, t->node, cast(size_t, sizenode(t)));
@@ -111,6 +111,32 @@ static int tconcat (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Preallocation and reuse
+** =======================================================
+*/
+
+static int tnew (lua_State *L) {
+  int narr = luaL_checkint(L, 1);
+  int nrec = luaL_optint(L, 2, 0);
+  luaL_argcheck(L, narr >= 0, 1, "size out of range");
+  luaL_argcheck(L, nrec >= 0, 2, "size out of range");
+  lua_createtable(L, narr, nrec);
+  return 1;
+}
+
+
+/* raw, metamethods are not called; the table keeps its capacity */
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Pack/unpack
@@ -265,6 +291,8 @@ static const luaL_Reg tab_funcs[] = {
   {"maxn", maxn},
 #endif
   {"insert", tinsert},
+  {"new", tnew},
+  {"clear", tclear},
   {"pack", pack},
   {"unpack", unpack},
   {"remove", tremove},
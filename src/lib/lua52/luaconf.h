@@ -545,6 +545,31 @@
 ** without modifying the main part of the file.
 */
 
+/*
+@@ LUA_USE_JUMPTABLE makes 'luaV_execute' dispatch opcodes through a
+** table of label addresses (computed goto, a GCC/Clang extension)
+** instead of a switch. Each opcode then ends with its own indirect
+** jump, which branch predictors handle much better than one shared
+** jump. Define LUA_NO_JUMPTABLE to keep the portable switch.
+*/
+#if defined(__GNUC__) && !defined(LUA_NO_JUMPTABLE)
+#define LUA_USE_JUMPTABLE
+#endif
+
+/*
+@@ LUA_USE_PATCACHE makes the string library keep the patterns it is
+** given, analyzed, in a small per-state cache: positions where a match
+** cannot start are skipped with 'memchr' and patterns made of single
+** character classes run from precomputed bitmaps instead of being
+** re-read by 'match'. Define LUA_NO_PATCACHE to interpret every pattern
+** from scratch.
+@@ LUA_PATCACHE_VERIFY checks every shortcut against 'match' and raises
+** an error on any difference (for testing only, it is slower).
+*/
+#if !defined(LUA_NO_PATCACHE)
+#define LUA_USE_PATCACHE
+#endif
+
 
 
 #endif
@@ -1,9 +1,519 @@
 #include <cstdio>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "include/Renderer.hpp"
+#include "include/Scheduler.hpp"
+#include "include/LuaAlloc.hpp"
+#include "include/LuaGC.hpp"
+#include "include/LuaCache.hpp"
+#include "include/LuaArchive.hpp"
+#include "include/LuaProfiler.hpp"
+#include "include/LuaScheduler.hpp"
+#include "include/LuaRenderer.hpp"
+#include "lib/lua52/lualib.h"
+#include "lib/lua52/lauxlib.h"
 
+/// initial sizes of the per frame input buffers, they grow as needed
+#define TEXT_INPUT_INIT 256
+#define EVENT_QUEUE_INIT 64
 
-int main(int argc, char const *argv[])
+/// longest stretch of deferred work between two looks at the event queue
+#define IDLE_SLICE 0.002
+/// Lua heap size that forces a full collection
+#define LUA_MEMORY_CEILING (512 * 1024 * 1024)
+/// set in the environment to attribute Lua memory to chunks (staging)
+#define LUA_MEMTRACK_ENV "ESSENCE_LUA_MEMTRACK"
+
+typedef struct {
+  SDL_Event e;
+  int textStart, textLen;  /* text input runs, in FrameInput.text */
+} QueuedEvent;
+
+/// Input gathered between two frames. Bursts of mouse motion and resizes
+/// collapse into one entry, consecutive text input into one run, the
+/// rest is queued in order
+typedef struct {
+  bool quit;
+  bool dirty;
+  bool resized;
+  bool displayChanged;
+  bool mouseMoved;
+  int mouseX, mouseY, mouseRelX, mouseRelY;
+  char *text;
+  int textLen, textCap;
+  QueuedEvent *events;
+  int eventCount, eventCap;
+} FrameInput;
+
+static SDL_Window *window;
+static lua_State *L;
+
+/// true while something animates (smooth scroll, caret blink), frames are
+/// then paced to the display refresh rate, otherwise the loop sleeps.
+/// Set from Lua with system.set_animating
+static bool animating;
+/// registry reference of the function set with system.set_event_handler
+static int eventHandler = LUA_NOREF;
+
+static void* checkAlloc (void *ptr)
+{
+  if (!ptr) {
+    fprintf(stderr, "Fatal error: Memory allocation failed\n");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+static float getScale (void)
+{
+  float dpi;
+  if (SDL_GetDisplayDPI(SDL_GetWindowDisplayIndex(window), &dpi, NULL, NULL) != 0) {
+    return 1;
+  }
+  /* quarter steps, fractional scales in between only blur glyphs */
+  float scale = (int) (dpi / 96.0f * 4 + 0.5f) / 4.0f;
+  return scale < 1 ? 1 : scale;
+}
+
+static double getFrameTime (void)
+{
+  SDL_DisplayMode mode;
+  int display = SDL_GetWindowDisplayIndex(window);
+  if (SDL_GetCurrentDisplayMode(display, &mode) != 0 || mode.refresh_rate <= 0) {
+    return 1.0 / 60;
+  }
+  return 1.0 / mode.refresh_rate;
+}
+
+/// compiled modules live next to the user's other files,
+/// without a writable place modules are simply parsed every time
+static void initModuleCache (void)
+{
+  char *pref = SDL_GetPrefPath("essence", "essence");
+  if (!pref) { return; }
+  char dir[4096];
+  snprintf(dir, sizeof(dir), "%sbytecode", pref);
+  SDL_free(pref);
+  struct stat st;
+  if (stat(dir, &st) == 0 || mkdir(dir, 0755) == 0) {
+    LuaCacheInit(L, dir);
+  }
+}
+
+/// modules packed by the build sit next to the executable
+static void openModuleArchive (void)
+{
+  char *base = SDL_GetBasePath();
+  if (!base) { return; }
+  char path[4096];
+  snprintf(path, sizeof(path), "%smodules.pack", base);
+  SDL_free(base);
+  LuaArchiveOpen(L, path);
+}
+
+/// system.set_animating(bool)
+static int setAnimating (lua_State *L)
+{
+  animating = lua_toboolean(L, 1);
+  return 0;
+}
+
+/// system.set_event_handler(fn), fn(type, ...) is called for every event
+/// of a frame before it is drawn, nil removes it
+static int setEventHandler (lua_State *L)
 {
+  if (!lua_isnoneornil(L, 1)) { luaL_checktype(L, 1, LUA_TFUNCTION); }
+  luaL_unref(L, LUA_REGISTRYINDEX, eventHandler);
+  eventHandler = LUA_NOREF;
+  if (!lua_isnoneornil(L, 1)) {
+    lua_pushvalue(L, 1);
+    eventHandler = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  return 0;
+}
+
+static const luaL_Reg systemLib[] = {
+  { "set_animating",      setAnimating    },
+  { "set_event_handler",  setEventHandler },
+  { NULL, NULL }
+};
+
+static int luaopen_system (lua_State *L)
+{
+  luaL_newlib(L, systemLib);
   return 1;
-}
\ No newline at end of file
+}
+
+/// `Essence --pack <out> <dir>`, run by build.sh
+static int pack (const char *out, const char *dir)
+{
+  L = LuaNewState(false);
+  if (!L) {
+    fprintf(stderr, "Fatal error: could not create the Lua state\n");
+    return 1;
+  }
+  int status = 0;
+  if (!LuaArchivePack(L, dir, out)) {
+    fprintf(stderr, "pack: %s\n", lua_tostring(L, -1));
+    status = 1;
+  }
+  lua_close(L);
+  return status;
+}
+
+static QueuedEvent* queueEvent (FrameInput *input, SDL_Event *e)
+{
+  if (input->eventCount == input->eventCap) {
+    input->eventCap = input->eventCap ? input->eventCap * 2 : EVENT_QUEUE_INIT;
+    input->events = (QueuedEvent*) checkAlloc(
+      realloc(input->events, input->eventCap * sizeof(QueuedEvent)));
+  }
+  QueuedEvent *q = &input->events[input->eventCount++];
+  q->e = *e;
+  q->textStart = q->textLen = 0;
+  return q;
+}
+
+static void appendText (FrameInput *input, const char *text)
+{
+  int len = strlen(text);
+  if (input->textLen + len + 1 > input->textCap) {
+    while (input->textLen + len + 1 > input->textCap) {
+      input->textCap = input->textCap ? input->textCap * 2 : TEXT_INPUT_INIT;
+    }
+    input->text = (char*) checkAlloc(realloc(input->text, input->textCap));
+  }
+  memcpy(input->text + input->textLen, text, len + 1);
+  input->textLen += len;
+}
+
+/// empties input for the next frame, the buffers are kept
+static void resetInput (FrameInput *input)
+{
+  for (int i = 0; i < input->eventCount; i++) {
+    SDL_Event *e = &input->events[i].e;
+    if (e->type == SDL_DROPFILE) { SDL_free(e->drop.file); }
+  }
+  FrameInput empty;
+  memset(&empty, 0, sizeof(empty));
+  empty.text = input->text;
+  empty.textCap = input->textCap;
+  empty.events = input->events;
+  empty.eventCap = input->eventCap;
+  *input = empty;
+}
+
+static void handleEvent (FrameInput *input, SDL_Event *e)
+{
+  switch (e->type) {
+    case SDL_QUIT:
+      input->quit = true;
+      break;
+
+    case SDL_WINDOWEVENT:
+      switch (e->window.event) {
+        case SDL_WINDOWEVENT_RESIZED:
+        case SDL_WINDOWEVENT_SIZE_CHANGED:
+          input->resized = true;
+          input->dirty = true;
+          break;
+        case SDL_WINDOWEVENT_EXPOSED:
+          input->dirty = true;
+          break;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+        case SDL_WINDOWEVENT_DISPLAY_CHANGED:
+          RSetScale(getScale());
+          input->displayChanged = true;
+          input->dirty = true;
+          break;
+#endif
+      }
+      break;
+
+    case SDL_MOUSEMOTION:
+      input->mouseMoved = true;
+      input->mouseX = e->motion.x;
+      input->mouseY = e->motion.y;
+      input->mouseRelX += e->motion.xrel;
+      input->mouseRelY += e->motion.yrel;
+      input->dirty = true;
+      break;
+
+    /* a key pressed between two runs keeps its place */
+    case SDL_TEXTINPUT: {
+      QueuedEvent *run = input->eventCount ? &input->events[input->eventCount - 1] : NULL;
+      if (!run || run->e.type != SDL_TEXTINPUT) {
+        run = queueEvent(input, e);
+        run->textStart = input->textLen;
+      }
+      appendText(input, e->text.text);
+      run->textLen = input->textLen - run->textStart;
+      input->dirty = true;
+      break;
+    }
+
+    /* drop events own their file name until resetInput */
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+    case SDL_MOUSEWHEEL:
+    case SDL_DROPFILE:
+      queueEvent(input, e);
+      input->dirty = true;
+      break;
+
+    default:
+      input->dirty = true;
+      break;
+  }
+}
+
+static const char* buttonName (int button)
+{
+  switch (button) {
+    case SDL_BUTTON_LEFT:   return "left";
+    case SDL_BUTTON_MIDDLE: return "middle";
+    case SDL_BUTTON_RIGHT:  return "right";
+    default:                return "?";
+  }
+}
+
+/// key names are lower case, "left shift", "return"
+static void pushKeyName (lua_State *L, SDL_Keycode sym)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "%s", SDL_GetKeyName(sym));
+  for (char *p = name; *p; p++) { *p = tolower((unsigned char) *p); }
+  lua_pushstring(L, name);
+}
+
+/// calls the event handler with the type and the nargs values pushed after it
+static void callHandler (int nargs)
+{
+  if (lua_pcall(L, nargs + 1, 0, 0) != LUA_OK) {
+    fprintf(stderr, "Error in event handler: %s\n", lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+}
+
+static void pushHandler (const char *type)
+{
+  lua_rawgeti(L, LUA_REGISTRYINDEX, eventHandler);
+  lua_pushstring(L, type);
+}
+
+/// hands the frame's input to Lua, the resize first and the mouse
+/// position last, queued events in between in the order they came
+static void deliverInput (FrameInput *input)
+{
+  if (eventHandler == LUA_NOREF) { return; }
+  if (input->resized) {
+    int w, h;
+    RGetSize(&w, &h, NULL);
+    pushHandler("resized");
+    lua_pushinteger(L, w);
+    lua_pushinteger(L, h);
+    callHandler(2);
+  }
+
+  for (int i = 0; i < input->eventCount; i++) {
+    QueuedEvent *q = &input->events[i];
+    SDL_Event *e = &q->e;
+    switch (e->type) {
+      case SDL_TEXTINPUT:
+        pushHandler("textinput");
+        lua_pushlstring(L, input->text + q->textStart, q->textLen);
+        callHandler(1);
+        break;
+      case SDL_KEYDOWN:
+      case SDL_KEYUP:
+        pushHandler(e->type == SDL_KEYDOWN ? "keypressed" : "keyreleased");
+        pushKeyName(L, e->key.keysym.sym);
+        callHandler(1);
+        break;
+      case SDL_MOUSEBUTTONDOWN:
+        pushHandler("mousepressed");
+        lua_pushstring(L, buttonName(e->button.button));
+        lua_pushinteger(L, e->button.x);
+        lua_pushinteger(L, e->button.y);
+        lua_pushinteger(L, e->button.clicks);
+        callHandler(4);
+        break;
+      case SDL_MOUSEBUTTONUP:
+        pushHandler("mousereleased");
+        lua_pushstring(L, buttonName(e->button.button));
+        lua_pushinteger(L, e->button.x);
+        lua_pushinteger(L, e->button.y);
+        callHandler(3);
+        break;
+      case SDL_MOUSEWHEEL:
+        pushHandler("mousewheel");
+        lua_pushinteger(L, e->wheel.y);
+        lua_pushinteger(L, e->wheel.x);
+        callHandler(2);
+        break;
+      case SDL_DROPFILE:
+        pushHandler("filedropped");
+        lua_pushstring(L, e->drop.file);
+        callHandler(1);
+        break;
+    }
+  }
+
+  if (input->mouseMoved) {
+    pushHandler("mousemoved");
+    lua_pushinteger(L, input->mouseX);
+    lua_pushinteger(L, input->mouseY);
+    lua_pushinteger(L, input->mouseRelX);
+    lua_pushinteger(L, input->mouseRelY);
+    callHandler(4);
+  }
+}
+
+static void update (FrameInput *input)
+{
+  /* the event has the size in window coordinates, the surface
+     is bigger than that on HiDPI displays */
+  if (input->resized) {
+    int w, h;
+    RGetSize(&w, &h, NULL);
+    RSetClipRect((RRect) { 0, 0, w, h });
+  }
+  deliverInput(input);
+}
+
+static void draw (void)
+{
+  int w, h;
+  RGetSize(&w, &h, NULL);
+  RRect all = { 0, 0, w, h };
+  RDrawRect(all, (RColor) { 0x2e, 0x2e, 0x32, 0xff });
+  RUpdateRects(&all, 1);
+}
+
+/// Sleeps in SDL_WaitEventTimeout until something happens, then drains
+/// whatever else queued up meanwhile so a burst costs a single frame.
+/// With no animation running the wait has no timeout at all.
+/// Deferred work gets what is left of each frame's budget, the rest runs
+/// in IDLE_SLICE pieces with the event queue checked in between, so input
+/// never waits behind more than one slice.
+static void run (void)
+{
+  double frameTime = getFrameTime();
+  double nextFrame = SchedTime();
+  FrameInput input;
+  memset(&input, 0, sizeof(input));
+  input.dirty = true;
+
+  for (;;) {
+    int timeout = -1;
+    if (SchedPending()) {
+      timeout = 0;
+    } else if (animating || input.dirty) {
+      /* rounded up so we don't spin right before the deadline */
+      double wait = nextFrame - SchedTime();
+      timeout = wait > 0 ? (int) (wait * 1000 + 0.999) : 0;
+    }
+
+    SDL_Event e;
+    if (SDL_WaitEventTimeout(&e, timeout)) {
+      handleEvent(&input, &e);
+      while (SDL_PollEvent(&e)) {
+        handleEvent(&input, &e);
+      }
+    }
+    if (input.quit) {
+      resetInput(&input);
+      free(input.text);
+      free(input.events);
+      break;
+    }
+
+    /* input keeps piling up in the same FrameInput until the frame is due */
+    double now = SchedTime();
+    bool wantFrame = input.dirty || animating;
+    if (!wantFrame || now < nextFrame) {
+      if (SchedPending()) {
+        double deadline = now + IDLE_SLICE;
+        if (wantFrame && nextFrame < deadline) { deadline = nextFrame; }
+        SchedRun(deadline);
+      }
+      continue;
+    }
+
+    SchedBeginFrame(frameTime);
+    LuaGCBeginFrame();
+    update(&input);
+    draw();
+    LuaGCEndFrame();
+    SchedRun(SchedFrameDeadline());
+
+    /* a window moved to another monitor may now run at another rate */
+    if (input.resized || input.displayChanged) { frameTime = getFrameTime(); }
+    resetInput(&input);
+    nextFrame += frameTime;
+    if (nextFrame < now) { nextFrame = now + frameTime; }
+  }
+}
+
+int main(int argc, char const *argv[])
+{
+  if (argc == 4 && !strcmp(argv[1], "--pack")) {
+    return pack(argv[2], argv[3]);
+  }
+
+  if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) != 0) {
+    fprintf(stderr, "Fatal error: SDL_Init failed: %s\n", SDL_GetError());
+    return 1;
+  }
+  SDL_EnableScreenSaver();
+
+  SDL_DisplayMode mode;
+  SDL_GetCurrentDisplayMode(0, &mode);
+  window = SDL_CreateWindow("Essence",
+    SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, mode.w * 0.8, mode.h * 0.8,
+    SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_HIDDEN);
+  if (!window) {
+    fprintf(stderr, "Fatal error: SDL_CreateWindow failed: %s\n", SDL_GetError());
+    SDL_Quit();
+    return 1;
+  }
+
+  RInit(window, getScale());
+
+  L = LuaNewState(getenv(LUA_MEMTRACK_ENV) != NULL);
+  if (!L) {
+    fprintf(stderr, "Fatal error: could not create the Lua state\n");
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return 1;
+  }
+  luaL_openlibs(L);
+  luaL_requiref(L, "renderer", luaopen_renderer, 1);
+  lua_pop(L, 1);
+  luaL_requiref(L, "profiler", luaopen_profiler, 1);
+  lua_pop(L, 1);
+  luaL_requiref(L, "memory", luaopen_memory, 1);
+  lua_pop(L, 1);
+  luaL_requiref(L, "gc", luaopen_gc, 1);
+  lua_pop(L, 1);
+  luaL_requiref(L, "system", luaopen_system, 1);
+  lua_pop(L, 1);
+  luaL_requiref(L, "scheduler", luaopen_scheduler, 1);
+  lua_pop(L, 1);
+  initModuleCache();
+  openModuleArchive();
+  LuaGCInit(L, LUA_MEMORY_CEILING);
+
+  run();
+
+  LuaProfStop();
+  lua_close(L);
+  SDL_DestroyWindow(window);
+  SDL_Quit();
+  return 0;
+}
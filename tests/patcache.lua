@@ -0,0 +1,85 @@
+-- Differential test of the string library's pattern cache: prints the
+-- result of find, match, gmatch and gsub for random subjects and
+-- patterns, one line per call. tests/patcache.sh runs it on builds with
+-- and without the cache and compares the output.
+--   lua tests/patcache.lua [seed [count]]
+
+local seed = tonumber(arg and arg[1]) or 1
+local count = tonumber(arg and arg[2]) or 20000
+math.randomseed(seed)
+local R = math.random
+
+local atoms = {
+  "a", "b", "x", " ", "_", "1", ".", "%a", "%d", "%s", "%w", "%p", "%.", "%%",
+  "%A", "%S", "%x", "%u", "%l", "%c", "%W", "%D", "%q", "%-", "%]", "[ab]",
+  "[^a]", "[%d_]", "[a-c]", "[%]]", "[^%s]", "[%w_]", "\xe9", "[\xe0-\xff]",
+  "%z", "^", "-"
+}
+-- captures, balances, frontiers and malformed pieces
+local specials = { "(", ")", "()", "%b()", "%f[%w]", "%1", "[", "%", "$", "[^", "%b(" }
+local suffixes = { "", "", "", "*", "+", "-", "?" }
+local chars = {
+  "a", "b", "x", " ", "_", "1", "2", ".", "(", ")", "\n", "\xe9", "\xff", "%",
+  "A", "$", "^", "-", "]"
+}
+
+local function pattern()
+  local t = {}
+  if R(3) == 1 then t[#t + 1] = "^" end
+  for _ = 1, R(0, 7) do
+    if R(12) == 1 then
+      t[#t + 1] = specials[R(#specials)]
+    else
+      t[#t + 1] = atoms[R(#atoms)] .. suffixes[R(#suffixes)]
+    end
+  end
+  if R(5) == 1 then t[#t + 1] = "$" end
+  return table.concat(t)
+end
+
+local function subject()
+  local t = {}
+  for _ = 1, R(0, 300) do t[#t + 1] = chars[R(#chars)] end
+  return table.concat(t)
+end
+
+local function show(ok, ...)
+  local t = { tostring(ok) }
+  for i = 1, select("#", ...) do
+    local v = select(i, ...)
+    t[#t + 1] = type(v) == "string" and string.format("%q", v) or tostring(v)
+  end
+  return table.concat(t, " ")
+end
+
+local function iterate(s, p)
+  local t = {}
+  local ok, err = pcall(function()
+    for a, b, c in string.gmatch(s, p) do
+      t[#t + 1] = show(true, a, b, c)
+      if #t > 60 then break end
+    end
+  end)
+  t[#t + 1] = show(ok, err)
+  return table.concat(t, "; ")
+end
+
+local function count1(...) return tostring(select("#", ...)) end
+
+-- a small pool so patterns come back, through the cache, many times
+local pool = {}
+for i = 1, 64 do pool[i] = pattern() end
+
+for i = 1, count do
+  local s = subject()
+  local p = R(2) == 1 and pool[R(#pool)] or pattern()
+  local init = R(-3, 6)
+  local max = R(4) == 1 and R(0, 3) or nil
+  print(i, "find", show(pcall(string.find, s, p, init)))
+  print(i, "match", show(pcall(string.match, s, p, init)))
+  print(i, "gmatch", iterate(s, p))
+  print(i, "gsub", show(pcall(string.gsub, s, p, "<%0>", max)))
+  print(i, "gsubf", show(pcall(string.gsub, s, p, count1)))
+  -- equal pattern strings at new addresses
+  if i % 1000 == 0 then collectgarbage() end
+end
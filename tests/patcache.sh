@@ -0,0 +1,42 @@
+#!/bin/bash
+# Runs tests/patcache.lua on three builds of the standalone interpreter:
+# the default one with the pattern cache, one without (-DLUA_NO_PATCACHE)
+# and one checking every cache shortcut (-DLUA_PATCACHE_VERIFY), then
+# compares their output. Run from the repository root:
+#   tests/patcache.sh [seed [count]]
+
+cflags="-O2 -std=gnu++17 -fno-strict-aliasing -DLUA_USE_POSIX -Isrc/lib/lua52"
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+sources=""
+for f in `find src/lib/lua52 -name "*.c"`; do
+  sources="$sources $f"
+done
+
+echo "building..."
+for build in cached:"" plain:-DLUA_NO_PATCACHE verify:-DLUA_PATCACHE_VERIFY; do
+  g++ $cflags ${build#*:} -o "$tmp/${build%%:*}" -x c++ src/lib/lua52/lua.c_ $sources -lm || exit 1
+done
+
+status=0
+for build in cached plain verify; do
+  "$tmp/$build" tests/patcache.lua "$@" > "$tmp/$build.out" 2>&1
+  if [[ $? -ne 0 ]]; then
+    echo "$build: lua failed"
+    tail -3 "$tmp/$build.out"
+    status=1
+  fi
+done
+for build in cached verify; do
+  if ! cmp -s "$tmp/plain.out" "$tmp/$build.out"; then
+    echo "$build differs from the build without the cache:"
+    diff "$tmp/plain.out" "$tmp/$build.out" | head -20
+    status=1
+  fi
+done
+
+if [[ $status -eq 0 ]]; then
+  echo "ok, $(wc -l < "$tmp/plain.out") lines of output match"
+fi
+exit $status